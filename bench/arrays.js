@@ -0,0 +1,15 @@
+// Array building: push, slice, concat, map and join.
+var round = 0, i, sum = 0;
+var a, b;
+while (round < 400) {
+  a = [];
+  i = 0;
+  while (i < 300) {
+    a.push(i);
+    i++;
+  }
+  b = a.slice(100, 200).concat(a.slice(0, 50));
+  sum = sum + b.map(function (x) { return x + 1; }).join(",").length;
+  round++;
+}
+console.log(sum);
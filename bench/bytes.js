@@ -0,0 +1,19 @@
+// Byte-level processing with typed arrays: filling a buffer and counting
+// byte values.
+var bytes = new Uint8Array(262144);
+var counts = new Int32Array(256);
+var i, j, seed = 1, checksum = 0;
+for (i = 0; i < bytes.length; i++) {
+  seed = (seed * 77 + 73) & 65535;
+  bytes[i] = seed;
+}
+for (j = 0; j < 10; j++) {
+  for (i = 0; i < bytes.length; i++) {
+    counts[bytes[i]] += 1;
+  }
+}
+for (i = 0; i < 256; i++) {
+  checksum = (checksum * 31 + counts[i]) & 16777215;
+}
+console.log(counts[0] + " " + counts[255]);
+console.log(checksum);
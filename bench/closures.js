@@ -0,0 +1,34 @@
+// Closure-heavy combinator code, in the style of src/parser.js.
+var compose = function (f, g) {
+  return function (x) {
+    return f(g(x));
+  };
+};
+var twice = function (f) {
+  return compose(f, f);
+};
+var adder = function (n) {
+  return function (x) {
+    return x + n;
+  };
+};
+var counter = function () {
+  var n = 0;
+  return function () {
+    n = n + 1;
+    return n;
+  };
+};
+
+var next = counter();
+var total = 0, i = 0;
+while (i < 100000) {
+  total = total + twice(twice(adder(i & 7)))(i) - i;
+  next();
+  i++;
+}
+total = total + [1, 2, 3, 4, 5, 6, 7, 8].map(adder(1)).reduce(function (acc, x) {
+  return acc + x;
+}, 0);
+console.log(total);
+console.log(next());
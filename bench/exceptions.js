@@ -0,0 +1,21 @@
+// try/catch in loops, mostly without exceptions being thrown.
+var check = function (i) {
+  if ((i & 127) === 0) {
+    throw new TypeError("bad " + i);
+  }
+  return i & 15;
+};
+
+var i = 0, caught = 0, sum = 0;
+while (i < 150000) {
+  try {
+    sum = sum + check(i);
+  } catch (e) {
+    caught++;
+  } finally {
+    sum = sum + 1;
+  }
+  i++;
+}
+console.log(caught);
+console.log(sum);
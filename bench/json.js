@@ -0,0 +1,22 @@
+// Serializing records to JSON and parsing them back.
+var records = [];
+var i = 0, j, total = 0;
+while (i < 2000) {
+  records.push({ id: i, name: "record \"" + i + "\"", tags: ["a", "b\n", "c"], nested: { x: i & 7, ok: i < 1000 } });
+  i++;
+}
+var text = JSON.stringify(records);
+var parsed;
+j = 0;
+while (j < 20) {
+  parsed = JSON.parse(text);
+  i = 0;
+  while (i < parsed.length) {
+    total = total + parsed[i].nested.x + parsed[i].tags.length;
+    i++;
+  }
+  j++;
+}
+console.log(text.length);
+console.log(total);
+console.log(JSON.stringify(parsed[1999], null, 2).length);
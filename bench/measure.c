@@ -0,0 +1,54 @@
+// Runs a command and reports its wall-clock time and peak resident set size
+// as a JSON object on stdout. Standard output and error of the command are
+// redirected to given files.
+//
+// Usage: measure STDOUT_FILE STDERR_FILE COMMAND [ARGS...]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+static int redirect(const char* file_name, int fd) {
+    int file = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) return -1;
+    dup2(file, fd);
+    close(file);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    struct timeval start, end;
+    struct rusage usage;
+    int status;
+    pid_t pid;
+
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s STDOUT_FILE STDERR_FILE COMMAND [ARGS...]\n", argv[0]);
+        return 2;
+    }
+
+    gettimeofday(&start, NULL);
+    pid = fork();
+    if (pid == 0) {
+        if (redirect(argv[1], 1) < 0 || redirect(argv[2], 2) < 0) {
+            _exit(127);
+        }
+        execvp(argv[3], argv + 3);
+        _exit(127);
+    }
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0) {
+        perror("measure");
+        return 2;
+    }
+    gettimeofday(&end, NULL);
+
+    printf("{\"wall_ms\": %.3f, \"max_rss_kb\": %ld, \"status\": %d}\n",
+        (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_usec - start.tv_usec) / 1000.0,
+        usage.ru_maxrss,
+        WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+    return 0;
+}
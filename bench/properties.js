@@ -0,0 +1,35 @@
+// Property-heavy object code: records with several fields, read and updated
+// through prototype methods.
+var Point = function (x, y) {
+  this.x = x;
+  this.y = y;
+  this.label = "point";
+};
+Point.prototype.move = function (dx, dy) {
+  this.x = this.x + dx;
+  this.y = this.y + dy;
+};
+Point.prototype.norm = function () {
+  return this.x + this.y;
+};
+
+var points = [];
+var i = 0, round = 0, sum = 0;
+while (i < 200) {
+  points.push(new Point(i, 2 * i));
+  i++;
+}
+while (round < 2000) {
+  i = 0;
+  while (i < 200) {
+    points[i].move(1, 2);
+    i++;
+  }
+  round++;
+}
+i = 0;
+while (i < 200) {
+  sum = sum + points[i].norm();
+  i++;
+}
+console.log(sum);
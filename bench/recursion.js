@@ -0,0 +1,21 @@
+// Deep recursion and many small calls.
+var fib = function (n) {
+  if (n < 2) {
+    return n;
+  }
+  return fib(n - 1) + fib(n - 2);
+};
+var depth = function (n) {
+  if (n > 0) {
+    return 1 + depth(n - 1);
+  }
+  return 0;
+};
+
+var i = 0, total = 0;
+while (i < 1000) {
+  total = total + depth(1000);
+  i++;
+}
+console.log(fib(24));
+console.log(total);
@@ -0,0 +1,163 @@
+// Benchmark harness. Each workload is compiled with bin/compile and gcc, then
+// run several times, and the same source is run under Node as a baseline.
+// Results are printed to stdout as JSON, one line per workload and engine;
+// a human-readable summary goes to stderr.
+//
+// Usage: node bench/run.js [workload names...]
+// Environment: BENCH_RUNS (default 5), CFLAGS (default "-m32 -msse2 -O2").
+// Run from the repository root, after "make build".
+
+var fs = require("fs");
+var childProcess = require("child_process");
+
+var runs = parseInt(process.env.BENCH_RUNS || "5", 10);
+var cflags = (process.env.CFLAGS || "-m32 -msse2 -O2").split(" ").filter(function (flag) {
+  return flag !== "";
+});
+var outputDir = "build/bench";
+var dependencies = "ast=src/ast.js,parser=src/parser.js,c_backend=src/c_backend.js,bytecode_backend=src/bytecode_backend.js,compiler=src/compiler.js";
+
+var workloads = [
+  { name: "properties", source: "bench/properties.js" },
+  { name: "closures", source: "bench/closures.js" },
+  { name: "strings", source: "bench/strings.js" },
+  { name: "arrays", source: "bench/arrays.js" },
+  { name: "recursion", source: "bench/recursion.js" },
+  { name: "exceptions", source: "bench/exceptions.js" },
+  { name: "json", source: "bench/json.js" },
+  { name: "bytes", source: "bench/bytes.js" },
+  // The compiler compiling itself; its output contains generated function
+  // names, which depend on evaluation order, so it is not compared with Node.
+  { name: "self_compile", source: "src/run.js", dependencies: dependencies,
+    args: ["src/run.js", dependencies], compareOutput: false }
+];
+
+var run = function (command, args) {
+  var result = childProcess.spawnSync(command, args, { encoding: "utf8", maxBuffer: 1 << 30 });
+  if (result.status !== 0) {
+    throw command + " " + args.join(" ") + " failed:\n" + result.stderr;
+  }
+  return result.stdout;
+};
+
+// Runs command under bench/measure, returns wall time, peak RSS and outputs.
+var measure = function (command, args) {
+  var stdoutFile = outputDir + "/stdout.txt";
+  var stderrFile = outputDir + "/stderr.txt";
+  var result = JSON.parse(run(outputDir + "/measure", [stdoutFile, stderrFile, command].concat(args)));
+  if (result.status !== 0) {
+    throw command + " " + args.join(" ") + " exited with status " + result.status + ":\n" +
+      fs.readFileSync(stderrFile, "utf8");
+  }
+  result.stdout = fs.readFileSync(stdoutFile, "utf8");
+  result.stderr = fs.readFileSync(stderrFile, "utf8");
+  return result;
+};
+
+var median = function (values) {
+  var sorted = values.slice(0).sort(function (a, b) { return a - b; });
+  var middle = sorted.length >> 1;
+  if (sorted.length % 2 === 1) {
+    return sorted[middle];
+  } else {
+    return (sorted[middle - 1] + sorted[middle]) / 2;
+  }
+};
+
+var countLines = function (text, pattern) {
+  return text.split("\n").filter(function (line) {
+    return pattern.test(line);
+  }).length;
+};
+
+// Runs the engine "runs" times and summarizes timings. The runtime reports
+// collections on stderr when compiled with JS_GC_VERBOSE, Node does it on
+// stdout with --trace-gc.
+var benchmark = function (workload, engine, command, args, gcPattern, gcStream) {
+  var times = [], rss = [], gcCounts = [], stdout, i, result;
+  for (i = 0; i < runs; i++) {
+    result = measure(command, args);
+    times.push(result.wall_ms);
+    rss.push(result.max_rss_kb);
+    gcCounts.push(countLines(result[gcStream], gcPattern));
+    stdout = result.stdout.split("\n").filter(function (line) {
+      return !gcPattern.test(line);
+    }).join("\n");
+  }
+  return {
+    benchmark: workload.name,
+    engine: engine,
+    runs: runs,
+    median_ms: median(times),
+    min_ms: Math.min.apply(Math, times),
+    max_ms: Math.max.apply(Math, times),
+    max_rss_kb: Math.max.apply(Math, rss),
+    gc_count: median(gcCounts),
+    output: stdout
+  };
+};
+
+var benchmarkWorkload = function (workload) {
+  var binary = outputDir + "/" + workload.name;
+  var args = workload.args || [];
+  var compileArgs = [workload.source];
+  if (workload.dependencies) {
+    compileArgs.push(workload.dependencies);
+  }
+
+  var compiled = measure("bin/compile", compileArgs);
+  fs.writeFileSync(binary + ".c", compiled.stdout);
+  var gcc = measure("gcc", cflags.concat(["-DJS_GC_VERBOSE", "-I.", "-o", binary, binary + ".c"]));
+
+  var tatende = benchmark(workload, "tatende", binary, args, /^gc start/, "stderr");
+  tatende.compile_ms = compiled.wall_ms;
+  tatende.gcc_ms = gcc.wall_ms;
+
+  process.env.NODE_PATH = "src/";
+  var node = benchmark(workload, "node", "node", ["--trace-gc", workload.source].concat(args),
+    /(Scavenge|Mark-Compact|Mark-Sweep|Minor Mark)/, "stdout");
+
+  var matches = null;
+  if (workload.compareOutput !== false) {
+    matches = tatende.output === node.output;
+  }
+  return [tatende, node].map(function (result) {
+    delete result.output;
+    result.output_matches = matches;
+    return result;
+  });
+};
+
+var pad = function (value, width) {
+  value = String(value);
+  while (value.length < width) {
+    value = " " + value;
+  }
+  return value;
+};
+
+var main = function () {
+  var selected = process.argv.slice(2);
+  if (!fs.existsSync("bin/compile")) {
+    throw "bin/compile not found, run make build first";
+  }
+  if (!fs.existsSync(outputDir)) {
+    fs.mkdirSync(outputDir, { recursive: true });
+  }
+  run("gcc", ["-O2", "-o", outputDir + "/measure", "bench/measure.c"]);
+
+  process.stderr.write(pad("benchmark", 14) + pad("engine", 9) + pad("median ms", 11) +
+    pad("rss kB", 9) + pad("gc", 6) + pad("output", 8) + "\n");
+  workloads.filter(function (workload) {
+    return selected.length === 0 || selected.indexOf(workload.name) !== -1;
+  }).forEach(function (workload) {
+    benchmarkWorkload(workload).forEach(function (result) {
+      console.log(JSON.stringify(result));
+      process.stderr.write(pad(result.benchmark, 14) + pad(result.engine, 9) +
+        pad(result.median_ms.toFixed(1), 11) + pad(result.max_rss_kb, 9) + pad(result.gc_count, 6) +
+        pad(result.output_matches === null ? "-" : (result.output_matches ? "ok" : "DIFF"), 8) + "\n");
+    });
+  });
+};
+
+main();
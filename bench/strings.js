@@ -0,0 +1,25 @@
+// String concatenation, splitting and searching.
+var line = "";
+var text = "";
+var i = 0, j, count = 0;
+while (i < 1000) {
+  line = "";
+  j = 0;
+  while (j < 10) {
+    line = line + "word" + j + " ";
+    j++;
+  }
+  text = text + line + "\n";
+  i++;
+}
+var lines = text.split("\n");
+i = 0;
+while (i < lines.length) {
+  if (lines[i].indexOf("word9") !== -1) {
+    count++;
+  }
+  i++;
+}
+console.log(text.length);
+console.log(count);
+console.log(text.split("word").join("w").length);
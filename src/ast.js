@@ -37,6 +37,14 @@ var makeNodeConstructor = function (name, fields) {
       }
     };
   });
+  // Offset of the node in source code, if the parser was asked to record it.
+  constructor.prototype.position = function () {
+    return this._position;
+  };
+  constructor.prototype.setPosition = function (position) {
+    this._position = position;
+    return this;
+  };
   return constructor;
 };
 
@@ -94,3 +102,189 @@ exports.FunctionLiteral.prototype.localVariables = function () {
   this._localVariables = this._localVariables || [];
   return this._localVariables;
 };
+// Function literals have no names, but the compiler infers them from
+// assignments (e.g. "Array.prototype.map") for debugging and profiling.
+exports.FunctionLiteral.prototype.name = function () {
+  return this._name;
+};
+exports.FunctionLiteral.prototype.setName = function (name) {
+  this._name = name;
+};
+
+// Helpers below are shared by the backends.
+
+// Traverse function statements and move all declared variables to node's
+// localVariables property.
+// When var statement also assigns value, create new assign statement.
+// Please note this function will modify the tree in-place.
+exports.reorderVarStatements = function (functionNode) {
+  var visit = function (nodes) {
+    for (var i = 0; i < nodes.length; i++) {
+      var node = nodes[i];
+      var assignments = [];
+
+      var convertVarStatement = function (node) {
+        node.declarations().forEach(function (declaration) {
+          functionNode.addLocalVariable(declaration.identifier());
+          if (declaration instanceof exports.VarWithValueDeclaration) {
+            assignments.push(
+              exports.BinaryOp("=", exports.Variable(declaration.identifier()), declaration.expression()));
+          }
+        });
+        if (assignments.length > 0) {
+          return exports.ExpressionStatement(exports.Comma(assignments)).setPosition(node.position());
+        } else {
+          return null;
+        }
+      };
+
+      if (node instanceof exports.VarStatement) {
+        nodes[i] = convertVarStatement(node);
+      }
+      if (node instanceof exports.FunctionStatement) {
+        nodes[i] = convertVarStatement(exports.VarStatement([
+          exports.VarWithValueDeclaration(node.name(),
+            exports.FunctionLiteral(node.args(), node.statements()).setPosition(node.position())
+          )
+        ]));
+      }
+      if (node instanceof exports.IfStatement) {
+        visit(node.whenTruthy());
+        visit(node.whenFalsy());
+      }
+      if (node instanceof exports.ForStatement) {
+        if (node.initial() instanceof exports.VarStatement) {
+          nodes[i] = exports.ForStatement(
+            convertVarStatement(node.initial()),
+            node.condition(),
+            node.finalize(),
+            node.statements()
+          ).setPosition(node.position());
+        }
+        visit(node.statements());
+      }
+      if (node instanceof exports.TryStatement) {
+        visit(node.tryStatements());
+        visit(node.catchStatements());
+        visit(node.finallyStatements());
+      }
+    }
+  };
+  visit(functionNode.statements());
+};
+
+exports.needsArgumentsObject = function (node) {
+  if (node === null) {
+    return false;
+  }
+  switch (node.constructor) {
+    case exports.VarStatement:
+      return node.declarations().some(exports.needsArgumentsObject);
+
+    case exports.ReturnStatement:
+    case exports.ExpressionStatement:
+    case exports.ThrowStatement:
+      return exports.needsArgumentsObject(node.expression());
+
+    case exports.IfStatement:
+      return exports.needsArgumentsObject(node.condition()) ||
+        node.whenTruthy().some(exports.needsArgumentsObject) ||
+        node.whenFalsy().some(exports.needsArgumentsObject);
+
+    case exports.ForStatement:
+      return exports.needsArgumentsObject(node.initial()) ||
+        exports.needsArgumentsObject(node.condition()) ||
+        exports.needsArgumentsObject(node.finalize()) ||
+        node.statements().some(exports.needsArgumentsObject);
+
+    case exports.ForInStatement:
+      return exports.needsArgumentsObject(node.object()) ||
+        node.statements().some(exports.needsArgumentsObject);
+
+    case exports.WhileStatement:
+      return exports.needsArgumentsObject(node.condition()) ||
+        node.statements().some(exports.needsArgumentsObject);
+
+    case exports.TryStatement:
+      return node.tryStatements().some(exports.needsArgumentsObject) ||
+        node.catchStatements().some(exports.needsArgumentsObject) ||
+        node.finallyStatements().some(exports.needsArgumentsObject);
+
+    case exports.SwitchStatement:
+      return exports.needsArgumentsObject(node.expression()) ||
+        node.clauses().some(exports.needsArgumentsObject);
+
+    case exports.CaseClause:
+    case exports.DefaultClause:
+      return node.statements().some(exports.needsArgumentsObject);
+
+    case exports.BreakStatement:
+      return false;
+
+    case exports.NumberLiteral:
+    case exports.StringLiteral:
+    case exports.BooleanLiteral:
+    case exports.FunctionLiteral:
+    case exports.UndefinedLiteral:
+    case exports.NullLiteral:
+    case exports.ThisVariable:
+      return false;
+
+    case exports.ObjectLiteral:
+      return node.pairs().some(function (pair) { return exports.needsArgumentsObject(pair[1]); });
+
+    case exports.ArrayLiteral:
+      return node.items().some(exports.needsArgumentsObject);
+
+    case exports.Variable:
+      return (node.identifier() == "arguments");
+
+    case exports.Refinement:
+    case exports.UnaryOp:
+    case exports.PostIncrement:
+    case exports.PostDecrement:
+      return exports.needsArgumentsObject(node.expression());
+
+    case exports.Invocation:
+      return exports.needsArgumentsObject(node.expression()) ||
+        node.args().some(exports.needsArgumentsObject);
+
+    case exports.BinaryOp:
+      return exports.needsArgumentsObject(node.leftExpr()) ||
+        exports.needsArgumentsObject(node.rightExpr());
+
+    case exports.Comma:
+      return node.expressions().some(exports.needsArgumentsObject);
+
+    case exports.VarDeclaration:
+      return false;
+
+    case exports.VarWithValueDeclaration:
+      return exports.needsArgumentsObject(node.expression());
+
+    default:
+      throw "Incorrect AST";
+  }
+};
+
+// Calls visit(node, position) for every node of the tree, parents before
+// children, in source order. Position is the one of the node or of its
+// nearest ancestor which has it recorded.
+exports.walk = function (node, visit, position) {
+  var key;
+  if (node instanceof Array) {
+    node.forEach(function (child) {
+      exports.walk(child, visit, position);
+    });
+  } else if (node !== null && typeof node === "object") {
+    if (typeof node.position() !== "undefined") {
+      position = node.position();
+    }
+    visit(node, position);
+    for (key in node) {
+      if (node.hasOwnProperty(key) && key.charAt(0) !== "_") {
+        exports.walk(node[key], visit, position);
+      }
+    }
+  }
+};
@@ -0,0 +1,570 @@
+var AST = require("ast");
+
+// Compiles program AST to bytecode for the interpreter in js.c (see
+// runBytecode there), which runs it without a C compiler. The program has
+// the same structure as one compiled by c_backend.js: the prelude and the
+// program are functions called at start, variables are resolved the same
+// way, and object literals use the same layouts.
+//
+// Functions are sequences of integers: an opcode followed by its operands.
+// Operands of expressions are kept on the call stack. The result is text:
+//
+//   tatende-bytecode 1
+//   number of strings, then one string per line ("\" and new lines escaped)
+//   integers separated by white space:
+//     global names: count, string indices
+//     object layouts: count, then for each: keys count, string indices
+//     functions: count, then for each (on a separate line): arguments count,
+//       string indices, locals count, string indices, whether it uses the
+//       arguments object, number of for-in loops, code length, code
+//     indices of the prelude and program functions
+exports.compile = function (ast, options) {
+  var strings = [];
+  // Index of each string in strings, keys are prefixed with "$" so that they
+  // don't collide with properties of Object.prototype.
+  var stringIndices = {};
+  var globalNames = [];
+  var objectLayouts = [];
+  var functions = [];
+  // Names declared by enclosing functions and catch clauses, innermost last.
+  var scopes = [];
+  // Code of the function being compiled, the number of its for-in loops and
+  // slots of the loops enclosing the current statement.
+  var current;
+  // Positions of jumps to the end of the enclosing switch statement, or null
+  // if break is not allowed here, and how many for-in loops enclose it.
+  var breakJumps = null;
+  var breakForInLoops = 0;
+  // Whether calls in return statements can be left pending, like in
+  // c_backend.js; not in blocks of try statements.
+  var tailCalls = false;
+
+  options = options || {};
+
+  // Must match the order of opcodes in js.c.
+  var opcodeNames = [
+    "UNDEFINED", "NULL", "TRUE", "FALSE", "NUMBER", "STRING", "THIS",
+    "GET_LOCAL", "SET_LOCAL", "GET_GLOBAL", "SET_GLOBAL",
+    "GET_PROPERTY", "SET_PROPERTY", "EMPTY_OBJECT", "OBJECT", "FUNCTION",
+    "CALL", "CALL_METHOD", "NEW", "TAIL_CALL", "TAIL_CALL_METHOD",
+    "ADD", "SUB", "MUL", "LT", "GT", "EQ", "NEQ", "STRICT_EQ", "STRICT_NEQ",
+    "BIT_AND", "BIT_XOR", "BIT_OR", "AND", "OR", "INSTANCEOF",
+    "TYPEOF", "NOT", "TO_NUMBER", "NEGATE",
+    "POP", "DUP", "JUMP", "JUMP_IF_FALSE", "JUMP_IF_TRUE",
+    "FOR_IN_BEGIN", "FOR_IN_NEXT", "FOR_IN_END", "TRY", "THROW", "RETURN", "END"
+  ];
+  var opcodes = {};
+  var i = 0;
+  while (i < opcodeNames.length) {
+    opcodes[opcodeNames[i]] = i;
+    i++;
+  }
+
+  var operatorOpcodes = {
+    "+": "ADD", "-": "SUB", "*": "MUL",
+    "<": "LT", ">": "GT",
+    "==": "EQ", "!=": "NEQ",
+    "===": "STRICT_EQ", "!==": "STRICT_NEQ",
+    "&": "BIT_AND", "^": "BIT_XOR", "|": "BIT_OR",
+    "&&": "AND", "||": "OR",
+    "instanceof": "INSTANCEOF"
+  };
+
+  var stringIndex = function (s) {
+    var key = "$" + s;
+    if (! stringIndices.hasOwnProperty(key)) {
+      strings.push(s);
+      stringIndices[key] = strings.length - 1;
+    }
+    return stringIndices[key];
+  };
+
+  // Same rules as in c_backend.js.
+  var isGlobal = function (name) {
+    if (name === "arguments") {
+      return false;
+    }
+    return !scopes.some(function (scope) {
+      return scope.indexOf(name) !== -1;
+    });
+  };
+
+  var globalIndex = function (name) {
+    var i = globalNames.indexOf(name);
+    if (i === -1) {
+      globalNames.push(name);
+      i = globalNames.length - 1;
+    }
+    return i;
+  };
+
+  // Appends an instruction, returns position of its last operand.
+  var emit = function (name) {
+    var i = 1;
+    current.code.push(opcodes[name]);
+    while (i < arguments.length) {
+      current.code.push(arguments[i]);
+      i++;
+    }
+    return current.code.length - 1;
+  };
+
+  // Makes the jump operand at given position point to the next instruction.
+  var patch = function (position) {
+    current.code[position] = current.code.length;
+  };
+
+  var assignVariable = function (name) {
+    if (isGlobal(name)) {
+      emit("SET_GLOBAL", globalIndex(name));
+    } else {
+      emit("SET_LOCAL", stringIndex(name));
+    }
+  };
+
+  var statements = function (nodes) {
+    nodes.forEach(function (node) {
+      if (node !== null) {
+        statement(node);
+      }
+    });
+  };
+
+  var statement = function (node) {
+    var jump, loop;
+    switch (node.constructor) {
+      case AST.ReturnStatement:
+        if (tailCalls && node.expression() instanceof AST.Invocation) {
+          invocation(node.expression(), "TAIL_");
+        } else {
+          expression(node.expression());
+          emit("RETURN");
+        }
+        break;
+
+      case AST.ExpressionStatement:
+        expression(node.expression());
+        emit("POP");
+        break;
+
+      case AST.IfStatement:
+        expression(node.condition());
+        jump = emit("JUMP_IF_FALSE", 0);
+        statements(node.whenTruthy());
+        loop = emit("JUMP", 0);
+        patch(jump);
+        statements(node.whenFalsy());
+        patch(loop);
+        break;
+
+      case AST.ForStatement:
+        statements([
+          node.initial(),
+          AST.WhileStatement(node.condition(), node.statements().concat([node.finalize()]))
+        ]);
+        break;
+
+      case AST.ForInStatement:
+        forInStatement(node);
+        break;
+
+      case AST.WhileStatement:
+        loop = current.code.length;
+        expression(node.condition());
+        jump = emit("JUMP_IF_FALSE", 0);
+        statements(node.statements());
+        emit("JUMP", loop);
+        patch(jump);
+        break;
+
+      case AST.TryStatement:
+        tryStatement(node);
+        break;
+
+      case AST.ThrowStatement:
+        expression(node.expression());
+        emit("THROW");
+        break;
+
+      case AST.SwitchStatement:
+        switchStatement(node);
+        break;
+
+      case AST.BreakStatement:
+        if (breakJumps === null) {
+          throw "Unsupported break statement";
+        }
+        current.forInLoops.slice(breakForInLoops).reverse().forEach(function (slot) {
+          emit("FOR_IN_END", slot);
+        });
+        breakJumps.push(emit("JUMP", 0));
+        break;
+
+      default:
+        throw "Incorrect AST";
+    }
+  };
+
+  // Loops over a snapshot of keys, like in c_backend.js. Keys of loops which
+  // are left by return are released by the interpreter, by break here.
+  var forInStatement = function (node) {
+    var slot = current.forInSlots;
+    var outerLoops = current.forInLoops;
+    var loop, exit;
+    current.forInSlots++;
+    expression(node.object());
+    emit("FOR_IN_BEGIN", slot);
+    loop = current.code.length;
+    exit = emit("FOR_IN_NEXT", slot, 0);
+    assignVariable(node.identifier());
+    emit("POP");
+    current.forInLoops = outerLoops.concat([slot]);
+    statements(node.statements());
+    current.forInLoops = outerLoops;
+    emit("JUMP", loop);
+    patch(exit);
+    emit("FOR_IN_END", slot);
+  };
+
+  // Blocks follow the instruction, each ending with END. The interpreter runs
+  // them like c_backend.js runs its try, catch and finally functions.
+  var tryStatement = function (node) {
+    var catchStatements = node.catchStatements();
+    var catchIdentifier = node.identifier();
+    var outerBreakJumps = breakJumps;
+    var outerTailCalls = tailCalls;
+    var outerScopes = scopes;
+    var catchStart, finallyStart, after;
+    if (catchIdentifier === null) {
+      catchStatements = [AST.ThrowStatement(AST.Variable("e"))];
+      catchIdentifier = "e";
+    }
+    breakJumps = null;
+    tailCalls = false;
+    catchStart = emit("TRY", 0, 0, stringIndex(catchIdentifier), 0) - 3;
+    finallyStart = catchStart + 1;
+    after = catchStart + 3;
+    statements(node.tryStatements());
+    emit("END");
+    patch(catchStart);
+    scopes = scopes.concat([[catchIdentifier]]);
+    statements(catchStatements);
+    scopes = outerScopes;
+    emit("END");
+    patch(finallyStart);
+    statements(node.finallyStatements());
+    emit("END");
+    patch(after);
+    breakJumps = outerBreakJumps;
+    tailCalls = outerTailCalls;
+  };
+
+  // The value stays on the stack while clauses run and is popped at the end,
+  // where break jumps to.
+  var switchStatement = function (node) {
+    var outerBreakJumps = breakJumps;
+    var outerBreakForInLoops = breakForInLoops;
+    var clauseJumps = [];
+    var defaultJump, hasDefault = false;
+    breakJumps = [];
+    breakForInLoops = current.forInLoops.length;
+    expression(node.expression());
+    node.clauses().forEach(function (clause) {
+      if (clause instanceof AST.CaseClause) {
+        emit("DUP");
+        expression(clause.expression());
+        emit("STRICT_EQ");
+        clauseJumps.push(emit("JUMP_IF_TRUE", 0));
+      } else {
+        clauseJumps.push(null);
+      }
+    });
+    defaultJump = emit("JUMP", 0);
+    node.clauses().forEach(function (clause, i) {
+      if (clause instanceof AST.CaseClause) {
+        patch(clauseJumps[i]);
+      } else {
+        patch(defaultJump);
+        hasDefault = true;
+      }
+      statements(clause.statements());
+    });
+    if (! hasDefault) {
+      patch(defaultJump);
+    }
+    breakJumps.forEach(function (jump) {
+      patch(jump);
+    });
+    emit("POP");
+    breakJumps = outerBreakJumps;
+    breakForInLoops = outerBreakForInLoops;
+  };
+
+  var expression = function (node) {
+    switch (node.constructor) {
+      case AST.NumberLiteral:
+        emit("NUMBER", node.number() | 0);
+        break;
+
+      case AST.StringLiteral:
+        emit("STRING", stringIndex(node.string()));
+        break;
+
+      case AST.BooleanLiteral:
+        if (node.value()) {
+          emit("TRUE");
+        } else {
+          emit("FALSE");
+        }
+        break;
+
+      case AST.ObjectLiteral:
+        objectLiteral(node);
+        break;
+
+      case AST.ArrayLiteral:
+        newExpression(AST.Invocation(AST.Variable("Array"), node.items()));
+        break;
+
+      case AST.FunctionLiteral:
+        functionLiteral(node);
+        break;
+
+      case AST.UndefinedLiteral:
+        emit("UNDEFINED");
+        break;
+
+      case AST.NullLiteral:
+        emit("NULL");
+        break;
+
+      case AST.Variable:
+        if (isGlobal(node.identifier())) {
+          emit("GET_GLOBAL", globalIndex(node.identifier()));
+        } else {
+          emit("GET_LOCAL", stringIndex(node.identifier()));
+        }
+        break;
+
+      case AST.ThisVariable:
+        emit("THIS");
+        break;
+
+      case AST.Refinement:
+        expression(node.expression());
+        expression(node.key());
+        emit("GET_PROPERTY");
+        break;
+
+      case AST.Invocation:
+        invocation(node);
+        break;
+
+      case AST.BinaryOp:
+        binaryOp(node);
+        break;
+
+      case AST.UnaryOp:
+        unaryOp(node);
+        break;
+
+      case AST.PostIncrement:
+        expression(AST.BinaryOp("+=", node.expression(), AST.NumberLiteral(1)));
+        break;
+
+      case AST.PostDecrement:
+        expression(AST.BinaryOp("-=", node.expression(), AST.NumberLiteral(1)));
+        break;
+
+      case AST.Comma:
+        node.expressions().forEach(function (e, i) {
+          if (i > 0) {
+            emit("POP");
+          }
+          expression(e);
+        });
+        break;
+
+      default:
+        throw "Incorrect AST";
+    }
+  };
+
+  var objectLiteral = function (node) {
+    var layout = objectLayouts.length;
+    if (node.pairs().length === 0) {
+      emit("EMPTY_OBJECT");
+    } else {
+      objectLayouts.push([node.pairs().length].concat(node.pairs().map(function (property) {
+        return stringIndex(property[0]);
+      })));
+      node.pairs().forEach(function (property) {
+        expression(property[1]);
+      });
+      emit("OBJECT", layout, node.pairs().length);
+    }
+  };
+
+  var functionLiteral = function (node) {
+    AST.reorderVarStatements(node);
+    var index = functions.length;
+    var outer = current;
+    var outerScopes = scopes;
+    var outerBreakJumps = breakJumps;
+    var outerTailCalls = tailCalls;
+    var usesArguments = 0;
+    functions.push(null);
+    current = { code: [], forInSlots: 0, forInLoops: [] };
+    scopes = scopes.concat([node.args().concat(node.localVariables())]);
+    breakJumps = null;
+    tailCalls = true;
+    statements(node.statements());
+    emit("UNDEFINED");
+    emit("RETURN");
+    if (node.statements().some(AST.needsArgumentsObject)) {
+      usesArguments = 1;
+    }
+    functions[index] = [node.args().length].concat(
+      node.args().map(stringIndex),
+      [node.localVariables().length],
+      node.localVariables().map(stringIndex),
+      [usesArguments, current.forInSlots, current.code.length],
+      current.code
+    ).join(" ");
+    current = outer;
+    scopes = outerScopes;
+    breakJumps = outerBreakJumps;
+    tailCalls = outerTailCalls;
+    emit("FUNCTION", index);
+    return index;
+  };
+
+  // Calls in tail position (with prefix "TAIL_") end the function.
+  var invocation = function (node, prefix) {
+    prefix = prefix || "";
+    if (node.expression() instanceof AST.Refinement) {
+      expression(node.expression().expression());
+      expression(node.expression().key());
+      node.args().forEach(function (arg) {
+        expression(arg);
+      });
+      emit(prefix + "CALL_METHOD", node.args().length);
+    } else {
+      expression(node.expression());
+      node.args().forEach(function (arg) {
+        expression(arg);
+      });
+      emit(prefix + "CALL", node.args().length);
+    }
+  };
+
+  var newExpression = function (node) {
+    var args = [];
+    if (node instanceof AST.Invocation) {
+      args = node.args();
+      node = node.expression();
+    }
+    expression(node);
+    args.forEach(function (arg) {
+      expression(arg);
+    });
+    emit("NEW", args.length);
+  };
+
+  var binaryOp = function (node) {
+    var left = node.leftExpr();
+    if (node.operator() === "=") {
+      if (left instanceof AST.Variable) {
+        expression(node.rightExpr());
+        assignVariable(left.identifier());
+      } else if (left instanceof AST.Refinement) {
+        expression(left.expression());
+        expression(left.key());
+        expression(node.rightExpr());
+        emit("SET_PROPERTY");
+      } else {
+        throw "Invalid left-hand side in assignment";
+      }
+    } else if (node.operator() === "+=" || node.operator() === "-=") {
+      expression(AST.BinaryOp("=", left,
+        AST.BinaryOp(node.operator().replace("=", ""), left, node.rightExpr())));
+    } else if (typeof operatorOpcodes[node.operator()] === "undefined") {
+      throw "Unsupported operator: " + node.operator();
+    } else {
+      expression(left);
+      expression(node.rightExpr());
+      emit(operatorOpcodes[node.operator()]);
+    }
+  };
+
+  var unaryOp = function (node) {
+    switch (node.operator()) {
+      case "new":
+        newExpression(node.expression());
+        break;
+
+      case "typeof":
+        expression(node.expression());
+        emit("TYPEOF");
+        break;
+
+      case "void":
+        expression(node.expression());
+        emit("POP");
+        emit("UNDEFINED");
+        break;
+
+      case "!":
+        expression(node.expression());
+        emit("NOT");
+        break;
+
+      case "+":
+        expression(node.expression());
+        emit("TO_NUMBER");
+        break;
+
+      case "-":
+        expression(node.expression());
+        emit("NEGATE");
+        break;
+
+      default:
+        throw "Unsupported operator: " + node.operator();
+    }
+  };
+
+  var escapeString = function (s) {
+    return s.split("\\").join("\\\\").split("\n").join("\\n");
+  };
+
+  // The prelude and the program are wrapped like in c_backend.js.
+  var preludeFunction = AST.FunctionLiteral([], ast.slice(0, options.preludeStatements || 0));
+  ast = ast.slice(options.preludeStatements || 0);
+  var programFunction = AST.FunctionLiteral([],
+    [AST.TryStatement(
+      ast, "e",
+      [AST.ExpressionStatement(
+        AST.Invocation(
+          AST.Refinement(AST.Variable("console"), AST.StringLiteral("log")),
+          [AST.Variable("e")]
+        )
+      )], []
+    )]
+  );
+
+  // Instructions creating the prelude and program functions are not used.
+  current = { code: [], forInSlots: 0, forInLoops: [] };
+  var entryPoints = [functionLiteral(preludeFunction), functionLiteral(programFunction)];
+  var globals = [globalNames.length].concat(globalNames.map(stringIndex));
+  var layouts = [objectLayouts.length].concat(objectLayouts.map(function (layout) {
+    return layout.join(" ");
+  }));
+
+  return ["tatende-bytecode 1", strings.length].concat(
+    strings.map(escapeString),
+    [globals.join(" "), layouts.join(" "), functions.length],
+    functions,
+    [entryPoints.join(" ")]
+  ).join("\n");
+};
@@ -1,8 +1,55 @@
 var AST = require("ast");
 
-exports.compile = function (ast) {
+// Compiles program AST to C source code.
+// By default the result is a single string with a whole C program. When
+// options.functionsPerUnit is given, the program is split into several
+// translation units which can be compiled in parallel. In such case the result
+// is a list of [filename, contents] pairs, including shared header with
+// prototypes and a Makefile.
+exports.compile = function (ast, options) {
   var functions = [];
+  var prototypes = [];
+  var functionInfo = [];
+  var allocSites = ['{ "runtime", "(runtime)", "?", 0 }'];
+  var feedbackSites = [];
+  var globalNames = [];
+  // C functions of function literals, which heap snapshots refer to.
+  var functionNames = [];
+  // Keys of object literals, see JSObjectLayout in js.h.
+  var objectLayouts = [];
+  // Names declared by enclosing functions and catch clauses, innermost last.
+  var scopes = [];
   var breakLabel;
+  // C variables holding keys of for-in loops enclosing the current statement
+  // within the current C function, released when returning from inside, and
+  // how many of them enclose the switch which break leaves.
+  var forInLoops = [];
+  var breakForInLoops = 0;
+  // C function of the function literal being compiled, for calls in tail
+  // position. Null in try, catch and finally blocks, which are separate C
+  // functions and don't end the call.
+  var tailCalls = null;
+
+  // Position of the statement being compiled and name of the enclosing
+  // function, used to describe allocation sites.
+  var currentPosition;
+  var currentFunctionName = "(program)";
+
+  options = options || {};
+
+  // Profile written by the feedback build (see JS_FEEDBACK in js.c), if
+  // given: kind and two counts of every site.
+  var feedback = options.feedback;
+  // Operators with a fast path for numbers, see JS_NUMBERS_OPERATOR in js.h.
+  var numbersOperators = {
+    "+": "js_add_numbers", "-": "js_sub_numbers", "*": "js_mult_numbers",
+    "<": "js_lt_numbers", ">": "js_gt_numbers",
+    "==": "js_eq_numbers", "!=": "js_neq_numbers",
+    "===": "js_strict_eq_numbers", "!==": "js_strict_neq_numbers",
+    "&": "js_binary_and_numbers", "^": "js_binary_xor_numbers", "|": "js_binary_or_numbers"
+  };
+  // 1 << TypeNumber, see enum JSType in js.h.
+  var numberTypeBit = 2;
 
   var unique = function () {
     var i = 1;
@@ -15,20 +62,55 @@ exports.compile = function (ast) {
     return '"' + s + '"';
   };
 
+  // Variables not declared in any enclosing scope are properties of the
+  // global object. Generated code accesses them through per-environment
+  // cells (see js_get_global_cell in js.c), numbered by the compiler.
+  // "arguments" is declared implicitly, so it's never global.
+  var isGlobal = function (name) {
+    if (name === "arguments") {
+      return false;
+    }
+    return !scopes.some(function (scope) {
+      return scope.indexOf(name) !== -1;
+    });
+  };
+
+  var globalCell = function (name) {
+    var i = globalNames.indexOf(name);
+    if (i === -1) {
+      globalNames.push(name);
+      i = globalNames.length - 1;
+    }
+    return i;
+  };
+
+  var assignVariable = function (name, value) {
+    if (isGlobal(name)) {
+      return "js_set_global_cell(env, " + globalCell(name) + ", " + value + ")";
+    }
+    return "js_assign_variable(env, binding, string_from_cstring(" + quotes(name) + "), " + value + ")";
+  };
+
   var statement = function (node) {
     if (node === null) {
       return "";
     }
+    if (typeof node.position() !== "undefined") {
+      currentPosition = node.position();
+    }
 
     switch (node.constructor) {
       case AST.ReturnStatement:
-        return "ret = " + expression(node.expression()) + "; goto end;";
+        if (tailCalls !== null && node.expression() instanceof AST.Invocation) {
+          return tailCall(node.expression());
+        }
+        return "ret = " + expression(node.expression()) + "; " + endForInLoops() + "goto end;";
 
       case AST.ExpressionStatement:
         return expression(node.expression()) + ";";
 
       case AST.IfStatement:
-        return "if (js_is_truthy(" + expression(node.condition()) + "))" +
+        return "if (" + condition(node.condition()) + ")" +
           "{ " + node.whenTruthy().map(statement).join("") + " } " +
           "else { " + node.whenFalsy().map(statement).join("") + " }";
 
@@ -39,22 +121,10 @@ exports.compile = function (ast) {
         ].map(statement).join("");
 
       case AST.ForInStatement:
-        return "{" +
-            "JSObject* object = js_to_object(env, " + expression(node.object()) + ").as.object;\n" +
-            "while (object) {\n"+
-              "int i = 0;\n" +
-              "while (i < object->properties_count) {\n" +
-                "js_assign_variable(env, binding, string_from_cstring(" + quotes(node.identifier()) + ")," +
-                  "js_string_value_from_string(object->properties[i].key));\n" +
-                node.statements().map(statement).join("") +
-                "i++;\n" +
-              "}\n" +
-              "object = object->prototype;\n" +
-            "}" +
-          "}";
+        return forInStatement(node);
 
       case AST.WhileStatement:
-        return "while (js_is_truthy(" + expression(node.condition()) + "))" +
+        return "while (" + condition(node.condition()) + ")" +
           "{ " + node.statements().map(statement).join("") + " }; ";
 
       case AST.TryStatement:
@@ -67,26 +137,117 @@ exports.compile = function (ast) {
         return switchStatement(node);
 
       case AST.BreakStatement:
-        return "goto " + breakLabel + ";";
+        return endForInLoops(breakForInLoops) + "goto " + breakLabel + ";";
 
       default:
         throw "Incorrect AST";
     }
   };
 
+  // Conditions which were true or false almost always in the feedback profile
+  // are marked as likely or unlikely, so gcc moves the other path out of the
+  // way.
+  var condition = function (node) {
+    var site = node._branchSite;
+    var code = "js_is_truthy(" + expression(node) + ")";
+    var counts;
+    if (typeof site === "undefined") {
+      return code;
+    }
+    code = "JS_BRANCH(" + site + ", " + code + ")";
+    if (feedback) {
+      counts = feedback[site].counts;
+      if (counts[0] > 99 * counts[1]) {
+        return "JS_LIKELY(" + code + ")";
+      } else if (counts[1] > 99 * counts[0]) {
+        return "JS_UNLIKELY(" + code + ")";
+      }
+    }
+    return code;
+  };
+
+  // Loops over a snapshot of keys (see js_for_in_begin in js.c). The loop
+  // variable is resolved once, before the first iteration.
+  var forInStatement = function (node) {
+    var name = "for_in_" + unique();
+    var identifier = node.identifier();
+    var assign;
+    var slot = "";
+    if (isGlobal(identifier)) {
+      assign = "js_set_global_cell(env, " + globalCell(identifier) + ", " + name + "_key);\n";
+    } else {
+      slot = "JSValue* " + name + "_slot = js_variable_slot(binding, string_from_cstring(" + quotes(identifier) + "));\n";
+      assign = "*" + name + "_slot = " + name + "_key;\n";
+    }
+    var outerLoops = forInLoops;
+    forInLoops = forInLoops.concat([name]);
+    var body = node.statements().map(statement).join("");
+    forInLoops = outerLoops;
+    return "{\n" +
+        "JSForInKeys* " + name + " = js_for_in_begin(env, " + expression(node.object()) + ");\n" +
+        slot +
+        "unsigned int " + name + "_i;\n" +
+        "for (" + name + "_i = 0; " + name + " && " + name + "_i < " + name + "->count; " + name + "_i++) {\n" +
+          "JSValue " + name + "_key = js_string_value_from_string(" + name + "->keys[" + name + "_i]);\n" +
+          assign +
+          body +
+        "}\n" +
+        "js_for_in_end(env, " + name + ");\n" +
+      "}";
+  };
+
+  // A call in tail position is left pending (see js_tail_call in js.c) and
+  // made after the function returns, so its frame is gone by then. If the
+  // callee is the function itself, the call becomes a jump to its beginning.
+  var tailCall = function (node) {
+    var parts = ["js_check_call_stack_overflow(env, " + node.args().length + ")"];
+    node.args().forEach(function (arg) {
+      parts.push("js_call_stack_push(env, " + expression(arg) + ")");
+    });
+    if (node.expression() instanceof AST.Refinement) {
+      parts.push("js_tail_call_method(env, " + expression(node.expression().expression()) + ", " +
+        expression(node.expression().key()) + ", " + node.args().length + ")");
+    } else {
+      parts.push("js_tail_call(env, " + expression(node.expression()) + ", env->global, " + node.args().length + ")");
+    }
+    tailCalls.used = true;
+    return "(" + parts.join(", ") + ");\n" + endForInLoops() +
+      "if (JS_TAIL_CALL_IS_SELF(&" + tailCalls.name + ")) { goto tail_call; }\n" +
+      "goto end;";
+  };
+
+  // Ends loops from the innermost one, leaving the outer count of them.
+  var endForInLoops = function (outer) {
+    return forInLoops.slice(outer || 0).reverse().map(function (name) {
+      return "js_for_in_end(env, " + name + "); ";
+    }).join("");
+  };
+
+  // Adds C function to the program. Prototypes are needed only when functions
+  // are spread over several translation units.
+  var defineFunction = function (signature, body) {
+    prototypes.push(signature + ";");
+    functions.push(signature + " {\n" + body + "}\n");
+  };
+
   var tryStatement = function (node) {
     var toCFunction = function (name, statements) {
-      return "JSValue " + name + "(JSEnv* env, JSValue this, JSObject* binding, int* returned) {\n" +
+      var outerLoops = forInLoops;
+      var outerTailCalls = tailCalls;
+      forInLoops = [];
+      tailCalls = null;
+      defineFunction("JSValue " + name + "(JSEnv* env, JSValue this, JSObject* binding, int* returned)",
         "JSValue ret = js_new_undefined();\n" +
         statements.map(statement).join("\n") +
         "*returned = 0;\n" +
         "end:\n" +
-        "return ret;\n" +
-        "}";
+        "return ret;\n");
+      forInLoops = outerLoops;
+      tailCalls = outerTailCalls;
     };
 
     var tryFunc = "try_" + unique();
-    functions.push(toCFunction(tryFunc, node.tryStatements()));
+    toCFunction(tryFunc, node.tryStatements());
 
     var catchFunc = "catch_" + unique();
     var catchStatements = node.catchStatements();
@@ -95,10 +256,13 @@ exports.compile = function (ast) {
       catchStatements = [AST.ThrowStatement(AST.Variable("e"))];
       catchIdentifier = "e";
     }
-    functions.push(toCFunction(catchFunc, catchStatements));
+    var outerScopes = scopes;
+    scopes = scopes.concat([[catchIdentifier]]);
+    toCFunction(catchFunc, catchStatements);
+    scopes = outerScopes;
 
     var finallyFunc = "finally_" + unique();
-    functions.push(toCFunction(finallyFunc, node.finallyStatements()));
+    toCFunction(finallyFunc, node.finallyStatements());
 
     return "{\n" +
       "JSException* exc = js_push_new_exception(env);\n" +
@@ -107,7 +271,7 @@ exports.compile = function (ast) {
         "JSValue inner_ret = " + tryFunc + "(env, this, binding, &returned);\n" +
         "js_pop_exception(env);\n" +
         finallyFunc + "(env, this, binding, &finally_returned);\n" +
-        "if (returned) { ret = inner_ret; goto end; }\n" +
+        "if (returned) { ret = inner_ret; " + endForInLoops() + "goto end; }\n" +
       "} else {\n" +
         "int returned = 1, finally_returned = 0;\n" +
         "JSObject* catch_binding = object_new(binding);\n" +
@@ -115,21 +279,74 @@ exports.compile = function (ast) {
         "js_pop_exception(env);\n" +
         "JSValue inner_ret = " + catchFunc + "(env, this, catch_binding, &returned);\n" +
         finallyFunc + "(env, this, binding, &finally_returned);\n" +
-        "if (returned) { ret = inner_ret; goto end; }\n" +
+        "if (returned) { ret = inner_ret; " + endForInLoops() + "goto end; }\n" +
       "}\n}\n";
   };
 
+  // Switches whose case labels are all number literals or all string
+  // literals dispatch in constant time: numbers with a C switch, strings with
+  // a hash table built on first use (see js_switch_string in js.c). Other
+  // switches compare the value with each label in turn.
   var switchStatement = function (node) {
     var name = "switch_" + unique();
     var switchEnd = name + "_end";
+    var outerBreakLabel = breakLabel;
+    var outerBreakForInLoops = breakForInLoops;
     breakLabel = switchEnd;
+    breakForInLoops = forInLoops.length;
     node.clauses().forEach(function (clause, i) { clause.index = i; });
-    var conditions = node.clauses().filter(function (clause) {
+    var caseClauses = node.clauses().filter(function (clause) {
       return clause instanceof AST.CaseClause;
-    }).map(function (clause) {
-      return "if (js_strict_eq(env, switch_value, " + expression(clause.expression()) + ").as.boolean) " +
-        "{ goto " + name + "_" + clause.index + "; }\n";
-    }).join(" else ") + " else { goto " + name + "_default; }";
+    });
+    var defaultLabel = switchEnd;
+    if (caseClauses.length < node.clauses().length) {
+      defaultLabel = name + "_default";
+    }
+    var allLiterals = function (constructor) {
+      return caseClauses.length > 0 && !caseClauses.some(function (clause) {
+        return clause.expression().constructor !== constructor;
+      });
+    };
+    // Labels of a C switch must be unique, the first matching clause wins.
+    var firstClauses = function (value) {
+      var values = [];
+      return caseClauses.filter(function (clause) {
+        var v = value(clause.expression());
+        if (values.indexOf(v) !== -1) {
+          return false;
+        }
+        values.push(v);
+        return true;
+      });
+    };
+    var conditions;
+    if (allLiterals(AST.NumberLiteral)) {
+      conditions = "if (switch_value.type == TypeNumber) {\n" +
+          "switch (switch_value.as.number) {\n" +
+          firstClauses(function (e) { return e.number(); }).map(function (clause) {
+            return "case " + clause.expression().number() + ": goto " + name + "_" + clause.index + ";\n";
+          }).join("") +
+          "}\n" +
+        "}\n" +
+        "goto " + defaultLabel + ";\n";
+    } else if (allLiterals(AST.StringLiteral)) {
+      var clauses = firstClauses(function (e) { return e.string(); });
+      conditions = "static JSSwitchTable table;\n" +
+        "static char* cases[] = { " + clauses.map(function (clause) {
+          return quotes(escapeCString(clause.expression().string()));
+        }).join(", ") + " };\n" +
+        "switch (js_switch_string(&table, cases, " + clauses.length + ", switch_value)) {\n" +
+          clauses.map(function (clause, i) {
+            return "case " + i + ": goto " + name + "_" + clause.index + ";\n";
+          }).join("") +
+        "}\n" +
+        "goto " + defaultLabel + ";\n";
+    } else {
+      conditions = caseClauses.map(function (clause) {
+        return "if (js_strict_eq(env, switch_value, " + expression(clause.expression()) + ").as.boolean) " +
+          "{ goto " + name + "_" + clause.index + "; }\n";
+      }).join("") + "goto " + defaultLabel + ";\n";
+    }
     var statements = node.clauses().map(function (clause) {
       var clauseName;
       if (clause instanceof AST.CaseClause) {
@@ -139,6 +356,8 @@ exports.compile = function (ast) {
       }
       return clauseName + ":;\n" + clause.statements().map(statement).join("\n") + "\n";
     }).join("\n") + "\n";
+    breakLabel = outerBreakLabel;
+    breakForInLoops = outerBreakForInLoops;
     return "{\n" +
         "JSValue switch_value = " + expression(node.expression()) + ";\n" +
         conditions + ";\n"+
@@ -149,6 +368,9 @@ exports.compile = function (ast) {
 
   var escapeCString = function (str) {
     var replace = function (str, p, r) {
+      if (str.indexOf(p) === -1) {
+        return str;
+      }
       return str.split(p).join(r);
     };
     str = replace(str, "\\", "\\\\");
@@ -189,6 +411,9 @@ exports.compile = function (ast) {
         return "js_new_null()";
 
       case AST.Variable:
+        if (isGlobal(node.identifier())) {
+          return "JS_GLOBAL_CELL(" + globalCell(node.identifier()) + ")";
+        }
         return "js_get_variable_rvalue(env, binding, string_from_cstring(" + quotes(node.identifier()) + "))";
 
       case AST.ThisVariable:
@@ -209,10 +434,10 @@ exports.compile = function (ast) {
         return unaryOp(node);
 
       case AST.PostIncrement:
-        return expression(AST.BinaryOp("+=", node.expression(), AST.NumberLiteral(1)));
+        return expression(withFeedbackSite(AST.BinaryOp("+=", node.expression(), AST.NumberLiteral(1)), node));
 
       case AST.PostDecrement:
-        return expression(AST.BinaryOp("-=", node.expression(), AST.NumberLiteral(1)));
+        return expression(withFeedbackSite(AST.BinaryOp("-=", node.expression(), AST.NumberLiteral(1)), node));
 
       case AST.Comma:
         return "(" + node.expressions().map(expression).join(", ") + ")";
@@ -222,14 +447,32 @@ exports.compile = function (ast) {
     }
   };
 
+  // Values of a non-empty literal are pushed on the call stack, which keeps
+  // them reachable, and the object is allocated with all properties at once.
   var objectLiteral = function (node) {
-    return node.pairs().reduce(function (acc, property) {
-      return "js_add_property(env, " + acc + ", js_string_value_from_cstring(" + quotes(property[0]) + "), " + expression(property[1]) + ")";
-    }, "js_construct_object_value(env)");
+    var parts, keys, layout;
+    if (node.pairs().length === 0) {
+      return "JS_NEW_OBJECT(" + addAllocSite("object literal") + ")";
+    }
+    node.pairs().forEach(function (property) {
+      nameFunction(property[1], property[0]);
+    });
+    keys = node.pairs().map(function (property) {
+      return quotes(escapeCString(property[0]));
+    });
+    layout = objectLayouts.length;
+    objectLayouts.push("  { " + keys.length + ", (char*[]) { " + keys.join(", ") + " } }");
+    parts = ["js_check_call_stack_overflow(env, " + keys.length + ")"];
+    node.pairs().forEach(function (property) {
+      parts.push("js_call_stack_push(env, " + expression(property[1]) + ")");
+    });
+    parts.push("JS_NEW_OBJECT_LITERAL(" + addAllocSite("object literal") + ", &js_object_layouts[" +
+      layout + "], " + keys.length + ")");
+    return "(" + parts.join(", ") + ")";
   };
 
   var arrayLiteral = function (node) {
-    return expression(AST.UnaryOp("new", AST.Invocation(AST.Variable("Array"), node.items())));
+    return newExpression(AST.Invocation(AST.Variable("Array"), node.items()), "array literal");
   };
 
   // Utility function to create C list from array of strings
@@ -239,15 +482,175 @@ exports.compile = function (ast) {
     }, "list_create()");
   };
 
+  // Anonymous functions get names of variables or properties they're assigned
+  // to, e.g. "Array.prototype.map".
+  var nameFunction = function (node, name) {
+    if (node instanceof AST.FunctionLiteral) {
+      if (typeof node.name() === "undefined") {
+        node.setName(name);
+      }
+    }
+  };
+
+  var targetName = function (node) {
+    if (node instanceof AST.Variable) {
+      return node.identifier();
+    }
+    if (node instanceof AST.ThisVariable) {
+      return "this";
+    }
+    if (node instanceof AST.Refinement) {
+      if (node.key() instanceof AST.StringLiteral) {
+        return targetName(node.expression()) + "." + node.key().string();
+      }
+    }
+    return "?";
+  };
+
+  var locate = function (position) {
+    if (typeof position !== "undefined" && options.locate) {
+      return options.locate(position);
+    }
+    return { file: "?", line: 0 };
+  };
+
+  // Records C name, JS name and source location of the function for the
+  // profiler (see JS_PROFILE in js.c). Returns function's index in the table.
+  var addFunctionInfo = function (cName, node) {
+    var location = locate(node.position());
+    functionInfo.push("{ " + [
+      quotes(cName),
+      quotes(escapeCString(node.name() || "anonymous")),
+      quotes(escapeCString(location.file)),
+      location.line
+    ].join(", ") + " }");
+    return functionInfo.length - 1;
+  };
+
+  // Records allocation site at the current statement for the allocation
+  // profiler (see JS_ALLOC_PROFILE in js.c). Returns site's index.
+  var addAllocSite = function (kind) {
+    var location = locate(currentPosition);
+    allocSites.push("{ " + [
+      quotes(escapeCString(kind)),
+      quotes(escapeCString(currentFunctionName)),
+      quotes(escapeCString(location.file)),
+      location.line
+    ].join(", ") + " }");
+    return allocSites.length - 1;
+  };
+
+  // Records an operator or condition whose operands or outcomes are recorded
+  // by the feedback build. Returns site's index, which is also its index in
+  // the profile.
+  var addFeedbackSite = function (kind, position) {
+    var location = locate(position);
+    var index = feedbackSites.length;
+    if (feedback) {
+      if (index < feedback.length) {
+        if (feedback[index].kind !== kind) {
+          throw "Feedback profile doesn't match the program";
+        }
+      } else {
+        throw "Feedback profile doesn't match the program";
+      }
+    }
+    feedbackSites.push("{ " + [
+      quotes(escapeCString(kind)),
+      quotes(escapeCString(location.file)),
+      location.line
+    ].join(", ") + " }");
+    return index;
+  };
+
+  // Sites are numbered in a separate pass in source order, so that their
+  // numbers don't depend on the order in which code is generated (which
+  // differs between Node and the compiled compiler). Operators keep their
+  // site in _operandsSite, conditions of if statements and loops in
+  // _branchSite.
+  var numberFeedbackSites = function (ast) {
+    AST.walk(ast, function (node, position) {
+      var operator;
+      if (node instanceof AST.BinaryOp) {
+        operator = node.operator();
+        if (operator === "+=" || operator === "-=") {
+          operator = operator.charAt(0);
+        }
+      } else if (node instanceof AST.PostIncrement) {
+        operator = "+";
+      } else if (node instanceof AST.PostDecrement) {
+        operator = "-";
+      }
+      if (typeof operator !== "undefined") {
+        if (numbersOperators.hasOwnProperty(operator)) {
+          node._operandsSite = addFeedbackSite(operator, position);
+        }
+      }
+      if (node instanceof AST.IfStatement || node instanceof AST.WhileStatement ||
+          node instanceof AST.ForStatement) {
+        if (node.condition() !== null) {
+          node.condition()._branchSite = addFeedbackSite("branch", position);
+        }
+      }
+    });
+    if (feedback) {
+      if (feedback.length !== feedbackSites.length) {
+        throw "Feedback profile doesn't match the program";
+      }
+    }
+  };
+
+  // Nodes which the compiler rewrites keep the site of the original node.
+  var withFeedbackSite = function (rewritten, node) {
+    rewritten._operandsSite = node._operandsSite;
+    return rewritten;
+  };
+
   var functionLiteral = function (node) {
-    reorderVarStatements(node);
+    AST.reorderVarStatements(node);
     var name = "fun_" + unique();
+    functionNames.push(name);
+    var profileId = addFunctionInfo(name, node);
+    var outerPosition = currentPosition;
+    var outerFunctionName = currentFunctionName;
+    if (typeof node.position() !== "undefined") {
+      currentPosition = node.position();
+    }
+    currentFunctionName = node.name() || "anonymous";
+    var bindingSite = addAllocSite("binding");
+    var outerScopes = scopes;
+    var outerLoops = forInLoops;
+    var outerTailCalls = tailCalls;
+    var functionTailCalls = { name: name, used: false };
+    scopes = scopes.concat([node.args().concat(node.localVariables())]);
+    forInLoops = [];
+    tailCalls = functionTailCalls;
     var body = node.statements().map(statement).join("\n");
+    scopes = outerScopes;
+    forInLoops = outerLoops;
+    tailCalls = outerTailCalls;
+
+    // Self tail calls restart the function, collecting garbage like at the end
+    // of a call, because a loop written this way may run for long.
+    var start = "", restart = "";
+    if (functionTailCalls.used) {
+      start = "start:;\n";
+      restart = "tail_call:\n" +
+        "JS_TAIL_CALL_RESTART();\n" +
+        "if (js_gc_should_run(env)) {\n" +
+          "if (this.type == TypeObject) { " +
+            "js_gc_run(env, env->global.as.object, parent_binding, this.as.object, NULL);\n" +
+          "} else { " +
+            "js_gc_run(env, env->global.as.object, parent_binding, NULL);\n" +
+          "}" +
+        "}\n" +
+        "goto start;\n";
+    }
 
     var argumentsObjectDefinition = "";
-    if (node.statements().some(needsArgumentsObject)) {
+    if (node.statements().some(AST.needsArgumentsObject)) {
       argumentsObjectDefinition = "object_add_property(binding, string_from_cstring(\"arguments\"), " +
-        "js_invoke_constructor(env, "+
+        "JS_NEW(" + bindingSite + ", "+
           "js_get_property(env, env->global, js_string_value_from_cstring(\"Array\")), "+
           "stack_count)"+
         "); env->call_stack_count += stack_count;";
@@ -265,10 +668,13 @@ exports.compile = function (ast) {
       return "object_add_property(binding, string_from_cstring(" + quotes(identifier) + "), js_new_undefined());";
     }).join("\n");
 
-    var cFunction =
-      "JSValue " + name + "(JSEnv* env, JSValue this, int stack_count, JSObject* parent_binding) {\n" +
+    defineFunction("JSValue " + name + "(JSEnv* env, JSValue this, int stack_count, JSObject* parent_binding)",
+        "JS_PROFILE_ENTER(" + profileId + ");\n" +
+        start +
+        "JS_ALLOC_SITE(" + bindingSite + ");\n" +
         "JSObject* binding = object_new(parent_binding);\n" +
         "js_gc_save_object(env, binding);\n" +
+        "JS_ALLOC_SITE(0);\n" +
         argumentsObjectDefinition + "\n" +
         argumentsDefinition + "\n" +
         localDeclarations + "\n" +
@@ -286,164 +692,12 @@ exports.compile = function (ast) {
             "js_gc_run(env, env->global.as.object, parent_binding, NULL);\n" +
           "}" +
         "}\n" +
+        "JS_PROFILE_EXIT();\n" +
         "return ret;\n" +
-      "}\n";
-    functions.push(cFunction);
-    return "js_construct_function_object_value(env, &" + name + ", binding)";
-  };
-
-  // Traverse function statements and move all declared variables to node's
-  // localVariables property.
-  // When var statement also assigns value, create new assign statement.
-  // Please note this function will modify the tree in-place.
-  var reorderVarStatements = function (functionNode) {
-    var visit = function (nodes) {
-      for (var i = 0; i < nodes.length; i++) {
-        var node = nodes[i];
-        var assignments = [];
-
-        var convertVarStatement = function (node) {
-          node.declarations().forEach(function (declaration) {
-            functionNode.addLocalVariable(declaration.identifier());
-            if (declaration instanceof AST.VarWithValueDeclaration) {
-              assignments.push(
-                AST.BinaryOp("=", AST.Variable(declaration.identifier()), declaration.expression()));
-            }
-          });
-          if (assignments.length > 0) {
-            return AST.ExpressionStatement(AST.Comma(assignments));
-          } else {
-            return null;
-          }
-        };
-
-        if (node instanceof AST.VarStatement) {
-          nodes[i] = convertVarStatement(node);
-        }
-        if (node instanceof AST.FunctionStatement) {
-          nodes[i] = convertVarStatement(AST.VarStatement([
-            AST.VarWithValueDeclaration(node.name(),
-              AST.FunctionLiteral(node.args(), node.statements())
-            )
-          ]));
-        }
-        if (node instanceof AST.IfStatement) {
-          visit(node.whenTruthy());
-          visit(node.whenFalsy());
-        }
-        if (node instanceof AST.ForStatement) {
-          if (node.initial() instanceof AST.VarStatement) {
-            nodes[i] = AST.ForStatement(
-              convertVarStatement(node.initial()),
-              node.condition(),
-              node.finalize(),
-              node.statements()
-            );
-          }
-          visit(node.statements());
-        }
-        if (node instanceof AST.TryStatement) {
-          visit(node.tryStatements());
-          visit(node.catchStatements());
-          visit(node.finallyStatements());
-        }
-      }
-    };
-    visit(functionNode.statements());
-  };
-
-  var needsArgumentsObject = function (node) {
-    if (node === null) {
-      return false;
-    }
-    switch (node.constructor) {
-      case AST.VarStatement:
-        return node.declarations().some(needsArgumentsObject);
-
-      case AST.ReturnStatement:
-      case AST.ExpressionStatement:
-      case AST.ThrowStatement:
-        return needsArgumentsObject(node.expression());
-
-      case AST.IfStatement:
-        return needsArgumentsObject(node.condition()) ||
-          node.whenTruthy().some(needsArgumentsObject) ||
-          node.whenFalsy().some(needsArgumentsObject);
-
-      case AST.ForStatement:
-        return needsArgumentsObject(node.initial()) ||
-          needsArgumentsObject(node.condition()) ||
-          needsArgumentsObject(node.finalize()) ||
-          node.statements().some(needsArgumentsObject);
-
-      case AST.ForInStatement:
-        return needsArgumentsObject(node.object()) ||
-          node.statements().some(needsArgumentsObject);
-
-      case AST.WhileStatement:
-        return needsArgumentsObject(node.condition()) ||
-          node.statements().some(needsArgumentsObject);
-
-      case AST.TryStatement:
-        return node.tryStatements().some(needsArgumentsObject) ||
-          node.catchStatements().some(needsArgumentsObject) ||
-          node.finallyStatements().some(needsArgumentsObject);
-
-      case AST.SwitchStatement:
-        return needsArgumentsObject(node.expression()) ||
-          node.clauses().some(needsArgumentsObject);
-
-      case AST.CaseClause:
-      case AST.DefaultClause:
-        return node.statements().some(needsArgumentsObject);
-
-      case AST.BreakStatement:
-        return false;
-
-      case AST.NumberLiteral:
-      case AST.StringLiteral:
-      case AST.BooleanLiteral:
-      case AST.FunctionLiteral:
-      case AST.UndefinedLiteral:
-      case AST.NullLiteral:
-      case AST.ThisVariable:
-        return false;
-
-      case AST.ObjectLiteral:
-        return node.pairs().some(function (pair) { return needsArgumentsObject(pair[1]); });
-
-      case AST.ArrayLiteral:
-        return node.items().some(needsArgumentsObject);
-
-      case AST.Variable:
-        return (node.identifier() == "arguments");
-
-      case AST.Refinement:
-      case AST.UnaryOp:
-      case AST.PostIncrement:
-      case AST.PostDecrement:
-        return needsArgumentsObject(node.expression());
-
-      case AST.Invocation:
-        return needsArgumentsObject(node.expression()) ||
-          node.args().some(needsArgumentsObject);
-
-      case AST.BinaryOp:
-        return needsArgumentsObject(node.leftExpr()) ||
-          needsArgumentsObject(node.rightExpr());
-
-      case AST.Comma:
-        return node.expressions().some(needsArgumentsObject);
-
-      case AST.VarDeclaration:
-        return false;
-
-      case AST.VarWithValueDeclaration:
-        return needsArgumentsObject(node.expression());
-
-      default:
-        throw "Incorrect AST";
-    }
+        restart);
+    currentPosition = outerPosition;
+    currentFunctionName = outerFunctionName;
+    return "JS_NEW_FUNCTION(" + addAllocSite("function " + (node.name() || "anonymous")) + ", &" + name + ", binding)";
   };
 
   var withStackArgs = function (args, invocation) {
@@ -487,11 +741,9 @@ exports.compile = function (ast) {
     };
     var assignOperators = ["+=", "-="];
     if (node.operator() === "=") {
+      nameFunction(node.rightExpr(), targetName(node.leftExpr()));
       if (node.leftExpr() instanceof AST.Variable) {
-        return "js_assign_variable(env, binding, " +
-          "string_from_cstring(" + quotes(node.leftExpr().identifier()) + "), " +
-          expression(node.rightExpr()) +
-        ")";
+        return assignVariable(node.leftExpr().identifier(), expression(node.rightExpr()));
       } else if (node.leftExpr() instanceof AST.Refinement) {
         return "js_set_property(env, " + expression(node.leftExpr().expression()) + ", " +
           expression(node.leftExpr().key()) + ", " + expression(node.rightExpr()) + ")";
@@ -502,17 +754,37 @@ exports.compile = function (ast) {
     if (assignOperators.indexOf(node.operator()) !== -1) {
       return expression(
         AST.BinaryOp("=", node.leftExpr(),
-          AST.BinaryOp(
+          withFeedbackSite(AST.BinaryOp(
             node.operator().replace("=", ""),
             node.leftExpr(), node.rightExpr()
-        ))
+          ), node)
+        )
       );
     }
     if (typeof operatorFunctions[node.operator()] === "undefined") {
       throw "Unsupported operator: " + node.operator();
     }
-    return operatorFunctions[node.operator()] + "(env, " +
-      expression(node.leftExpr()) + ", " + expression(node.rightExpr())  + ")";
+    var site = node._operandsSite;
+    var allocSite = 0;
+    var left = expression(node.leftExpr());
+    var right = expression(node.rightExpr());
+    if (node.operator() === "+") {
+      allocSite = addAllocSite("concatenation");
+    }
+    if (typeof site !== "undefined") {
+      left = "JS_OPERAND(" + site + ", 0, " + left + ")";
+      right = "JS_OPERAND(" + site + ", 1, " + right + ")";
+      // Operands which were always numbers get a guarded fast path.
+      if (feedback) {
+        if (feedback[site].counts[0] === numberTypeBit && feedback[site].counts[1] === numberTypeBit) {
+          return numbersOperators[node.operator()] + "(env, " + allocSite + ", " + left + ", " + right + ")";
+        }
+      }
+    }
+    if (node.operator() === "+") {
+      return "JS_ADD(" + allocSite + ", " + left + ", " + right + ")";
+    }
+    return operatorFunctions[node.operator()] + "(env, " + left + ", " + right + ")";
   };
 
   var unaryOp = function (node) {
@@ -540,7 +812,7 @@ exports.compile = function (ast) {
     }
   };
 
-  var newExpression = function (node) {
+  var newExpression = function (node, kind) {
     var fun;
     var args;
 
@@ -551,34 +823,192 @@ exports.compile = function (ast) {
       fun = node;
       args = [];
     }
+    kind = kind || "new " + targetName(fun);
     return withStackArgs(args,
-      "js_invoke_constructor(env, " + expression(fun) + "," + args.length + ")"
+      "JS_NEW(" + addAllocSite(kind) + ", " + expression(fun) + "," + args.length + ")"
     );
   };
 
-  var addTemplate = function (program) {
+  var functionInfoTable = function () {
     return '' +
-      '#include <stdio.h>\n' +
-      '#include "src/js.c"\n' +
-      functions.join("\n") + "\n" +
-      'int main(int argc, char** argv) {\n' +
-      '  JSEnv* env = malloc(sizeof(JSEnv));\n' +
-      '  env->call_stack_count = 0;\n' +
+      '#ifdef JS_PROFILE\n' +
+      'JSFunctionInfo js_function_info[] = {\n' +
+      functionInfo.join(",\n") + '\n' +
+      '};\n' +
+      '#endif\n';
+  };
+
+  var allocSiteTable = function () {
+    return '' +
+      '#ifdef JS_ALLOC_PROFILE\n' +
+      'JSAllocSiteInfo js_alloc_sites[] = {\n' +
+      allocSites.join(",\n") + '\n' +
+      '};\n' +
+      '#endif\n';
+  };
+
+  var feedbackSiteTable = function () {
+    return '' +
+      '#ifdef JS_FEEDBACK\n' +
+      'JSFeedbackSiteInfo js_feedback_sites[] = {\n' +
+      feedbackSites.join(",\n") + '\n' +
+      '};\n' +
+      '#endif\n';
+  };
+
+  var globalNamesTable = function () {
+    return '' +
+      'char* js_global_names[] = {\n' +
+      globalNames.map(function (name) {
+        return quotes(escapeCString(name));
+      }).concat(["NULL"]).join(",\n") + '\n' +
+      '};\n';
+  };
+
+  // The table is defined before functions which refer to it.
+  var objectLayoutsTable = function () {
+    return "JSObjectLayout js_object_layouts[] = {\n" +
+      objectLayouts.concat(["  { 0 }"]).join(",\n") + "\n};\n";
+  };
+
+  var functionsTable = function () {
+    return "JSValue (*js_program_functions[])() = {\n" +
+      functionNames.map(function (name) {
+        return "  &" + name + ",\n";
+      }).join("") +
+      "  NULL\n};\n";
+  };
+
+  // js_program_setup and js_program_run are also used by the runtime to start
+  // workers (see js_worker_constructor in js.c). Setup either runs the
+  // prelude or, with JS_SNAPSHOT, loads the heap it left behind.
+  var mainFunction = function (program, prelude) {
+    return '' +
+      functionInfoTable() +
+      allocSiteTable() +
+      feedbackSiteTable() +
+      globalNamesTable() +
+      functionsTable() +
+      '#ifdef JS_SNAPSHOT\n' +
+      '#include JS_SNAPSHOT\n' +
+      '#endif\n' +
+      'void js_program_prelude(JSEnv* env) {\n' +
+      '  JSObject* binding = NULL;\n' +
+      '  JSValue this = js_new_undefined();\n' +
+      '  ' + prelude + ';\n' +
+      '}\n' +
+      'JSEnv* js_program_setup(int argc, char** argv) {\n' +
+      '  JSEnv* env = calloc(1, sizeof(JSEnv));\n' +
+      '  js_call_stack_setup(env);\n' +
       '  env->exceptions_count = 0;\n' +
-      '  env->global = js_object_value_from_object(object_new(NULL));\n' +
       '  js_gc_setup(env);\n' +
+      '#ifdef JS_ALLOC_PROFILE\n' +
+      '  js_alloc_profile_setup(env, js_alloc_sites, sizeof(js_alloc_sites) / sizeof(JSAllocSiteInfo));\n' +
+      '#endif\n' +
+      '#ifdef JS_FEEDBACK\n' +
+      '  js_feedback_setup(env, js_feedback_sites, sizeof(js_feedback_sites) / sizeof(JSFeedbackSiteInfo));\n' +
+      '#endif\n' +
+      '#ifdef JS_STATS\n' +
+      '  js_stats_setup(env);\n' +
+      '#endif\n' +
+      '  js_global_cells_setup(env, js_global_names);\n' +
+      '#ifdef JS_PROFILE\n' +
+      '  js_profile_setup(env, js_function_info, sizeof(js_function_info) / sizeof(JSFunctionInfo));\n' +
+      '#endif\n' +
+      '#ifdef JS_SNAPSHOT\n' +
+      '  js_snapshot_load(env, &js_snapshot, js_program_functions);\n' +
+      '#else\n' +
+      '  env->global = js_object_value_from_object(object_new(NULL));\n' +
       '  js_gc_save_object(env, env->global.as.object);\n' +
       '  js_create_native_objects(env);\n' +
+      '  js_program_prelude(env);\n' +
+      '  js_snapshot_write_if_requested(env, js_program_functions);\n' +
+      '#endif\n' +
+      '  js_resolve_intrinsics(env);\n' +
       '  js_create_argv(env, argc, argv);\n' +
+      '  return env;\n' +
+      '}\n' +
+      'void js_program_run(JSEnv* env) {\n' +
       '  JSObject* binding = NULL;\n' +
       '  JSValue this = js_new_undefined();\n' +
       '  ' + program + ';\n' +
+      '}\n' +
+      'int main(int argc, char** argv) {\n' +
+      '  js_program_run(js_program_setup(argc, argv));\n' +
       '  return 0;\n' +
       '}\n';
   };
 
+  var addTemplate = function (program, prelude) {
+    return '' +
+      '#include <stdio.h>\n' +
+      '#include "src/js.c"\n' +
+      objectLayoutsTable() +
+      functions.join("\n") + "\n" +
+      mainFunction(program, prelude);
+  };
+
+  // Splits functions into translation units of options.functionsPerUnit
+  // functions each. All units share program.h with prototypes of all
+  // functions, so they can call each other regardless of the order.
+  // The runtime (src/js.c) is compiled as a separate unit; TATENDE_ROOT in the
+  // generated Makefile should point to the directory containing src/.
+  var splitIntoUnits = function (program, prelude) {
+    var files = [];
+    var objects = ["js.o", "main.o"];
+    var i, unit;
+
+    files.push(["program.h",
+      '#include "src/js.h"\n' +
+      'extern JSObjectLayout js_object_layouts[];\n' +
+      prototypes.join("\n") + "\n"
+    ]);
+    files.push(["main.c",
+      '#include "program.h"\n' +
+      objectLayoutsTable() +
+      mainFunction(program, prelude)
+    ]);
+    for (i = 0; i * options.functionsPerUnit < functions.length; i++) {
+      unit = "unit_" + i;
+      files.push([unit + ".c",
+        '#include "program.h"\n' +
+        functions.slice(i * options.functionsPerUnit, (i + 1) * options.functionsPerUnit).join("\n")
+      ]);
+      objects.push(unit + ".o");
+    }
+    files.push(["Makefile",
+      "TATENDE_ROOT ?= " + (options.root || ".") + "\n" +
+      "CFLAGS ?= -O2\n" +
+      "OBJECTS = " + objects.join(" ") + "\n" +
+      "\n" +
+      "program: $(OBJECTS)\n" +
+      "\t$(CC) $(CFLAGS) -pthread -o $@ $(OBJECTS)\n" +
+      "\n" +
+      "js.o: $(TATENDE_ROOT)/src/js.c $(TATENDE_ROOT)/src/js.h\n" +
+      "\t$(CC) $(CFLAGS) -c -o $@ $<\n" +
+      "\n" +
+      "%.o: %.c program.h\n" +
+      "\t$(CC) $(CFLAGS) -I$(TATENDE_ROOT) -c -o $@ $<\n" +
+      "\n" +
+      "clean:\n" +
+      "\trm -f program $(OBJECTS)\n" +
+      "\n" +
+      ".PHONY: clean\n"
+    ]);
+    return files;
+  };
+
+  numberFeedbackSites(ast);
+
+  // Leading statements given by options.preludeStatements run in a separate
+  // function, during setup of the environment.
+  var preludeFunction = AST.FunctionLiteral([], ast.slice(0, options.preludeStatements || 0));
+  preludeFunction.setName("(prelude)");
+  var prelude = AST.Invocation(preludeFunction, []);
+  ast = ast.slice(options.preludeStatements || 0);
+
   // Wrap program statements in try {} block and anonymous function invocation.
-  var program = AST.Invocation(AST.FunctionLiteral([],
+  var programFunction = AST.FunctionLiteral([],
     [AST.TryStatement(
       ast, "e",
       [AST.ExpressionStatement(
@@ -588,7 +1018,13 @@ exports.compile = function (ast) {
         )
       )], []
     )]
-  ), []);
-
-  return addTemplate(expression(program));
+  );
+  programFunction.setName("(program)");
+  var program = AST.Invocation(programFunction, []);
+
+  if (options.functionsPerUnit) {
+    return splitIntoUnits(expression(program), expression(prelude));
+  } else {
+    return addTemplate(expression(program), expression(prelude));
+  }
 };
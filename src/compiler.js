@@ -1,9 +1,11 @@
 var fs = require("fs");
+var AST = require("ast");
 var parser = require("parser");
 var backend = require("c_backend");
+var bytecodeBackend = require("bytecode_backend");
 
 var readFile = function (filename) {
-  return fs.readFileSync(filename);
+  return fs.readFileSync(filename).toString();
 };
 
 var asModule = function (name, source) {
@@ -20,7 +22,207 @@ var parseDependenciesList = function (list) {
   }, {});
 };
 
-exports.compile = function (input, dependencies) {
+// Path leading from given directory back to the current one, for example
+// "../.." for "build/compile". Absolute paths are not supported.
+var pathBackFrom = function (directory) {
+  if (directory.charAt(0) === "/") {
+    return undefined;
+  }
+  return directory.split("/").filter(function (part) {
+    return part !== "" && part !== ".";
+  }).map(function () {
+    return "..";
+  }).join("/") || ".";
+};
+
+// Program source is a concatenation of several files, joined with new lines.
+// sourceLocator() returns a function which maps an offset in program source to
+// the name of file and line number.
+var sourceLocator = function (sources) {
+  // Offsets of new line characters, computed only for files that are needed.
+  var newLines = function (source) {
+    var i;
+    if (! source.newLines) {
+      source.newLines = [];
+      i = source.text.indexOf("\n");
+      while (i !== -1) {
+        source.newLines.push(i);
+        i = source.text.indexOf("\n", i + 1);
+      }
+    }
+    return source.newLines;
+  };
+
+  // Binary search for the number of elements of sorted array smaller than
+  // value. Steps are powers of two, from the largest to 1.
+  var countSmaller = function (array, value) {
+    var steps = [1], count = 0, i;
+    while (steps[steps.length - 1] < array.length) {
+      steps.push(2 * steps[steps.length - 1]);
+    }
+    for (i = steps.length - 1; i > -1; i--) {
+      if (count + steps[i] - 1 < array.length) {
+        if (array[count + steps[i] - 1] < value) {
+          count += steps[i];
+        }
+      }
+    }
+    return count;
+  };
+
+  return function (offset) {
+    var i = 0;
+    while (i + 1 < sources.length && offset > sources[i].text.length) {
+      offset = offset - sources[i].text.length - 1;
+      i++;
+    }
+    return { file: sources[i].file, line: countSmaller(newLines(sources[i]), offset) + 1 };
+  };
+};
+
+// Profile written by a program compiled with -DJS_FEEDBACK (see
+// feedback_at_exit in js.c): a header, then kind, two counts and location of
+// every site, one per line.
+var parseFeedback = function (text) {
+  var lines = text.split("\n");
+  if (lines[0].split(" ")[0] !== "tatende-feedback") {
+    throw "Invalid feedback profile";
+  }
+  return lines.slice(1).filter(function (line) {
+    return line !== "";
+  }).map(function (line) {
+    var fields = line.split(" ");
+    return { kind: fields[0], counts: [parseInt(fields[1], 10), parseInt(fields[2], 10)] };
+  });
+};
+
+// Names which js.c looks up by itself.
+var runtimeNames = ["Object", "Function", "Array", "Number", "String", "TypeError", "ReferenceError",
+  "SyntaxError", "ArrayBuffer", "Int32Array", "Uint8Array", "prototype", "constructor", "length",
+  "toString", "valueOf"];
+
+// Values whose evaluation has no effects.
+var isPure = function (node) {
+  if (node instanceof AST.ObjectLiteral) {
+    return !node.pairs().some(function (pair) { return !isPure(pair[1]); });
+  }
+  if (node instanceof AST.ArrayLiteral) {
+    return !node.items().some(function (item) { return !isPure(item); });
+  }
+  return node instanceof AST.FunctionLiteral || node instanceof AST.StringLiteral ||
+    node instanceof AST.NumberLiteral || node instanceof AST.BooleanLiteral ||
+    node instanceof AST.NullLiteral || node instanceof AST.UndefinedLiteral;
+};
+
+// For a statement like "a.b.c = value", with static keys, returns the base
+// variable, keys and value. Assignments to properties of global are seen as
+// assignments to the variable.
+var assignmentTarget = function (statement) {
+  var node, keys = [];
+  if (!(statement instanceof AST.ExpressionStatement)) {
+    return undefined;
+  }
+  node = statement.expression();
+  if (!(node instanceof AST.BinaryOp)) {
+    return undefined;
+  }
+  if (node.operator() !== "=") {
+    return undefined;
+  }
+  var value = node.rightExpr();
+  node = node.leftExpr();
+  while (node instanceof AST.Refinement) {
+    if (!(node.key() instanceof AST.StringLiteral)) {
+      return undefined;
+    }
+    keys.push(node.key().string());
+    node = node.expression();
+  }
+  if (!(node instanceof AST.Variable) || keys.length === 0) {
+    return undefined;
+  }
+  keys.reverse();
+  if (node.identifier() === "global" && keys.length > 1) {
+    return { base: keys[0], keys: keys.slice(1), value: value };
+  }
+  return { base: node.identifier(), keys: keys, value: value };
+};
+
+// Names used by a statement: identifiers and strings, which include static
+// property names. Strings count so that o["name"] and require("name") keep
+// definitions alive.
+var addUsedNames = function (statement, used) {
+  AST.walk(statement, function (node) {
+    if (node instanceof AST.Variable) {
+      used[node.identifier()] = true;
+    }
+    if (node instanceof AST.StringLiteral) {
+      used[node.string()] = true;
+    }
+  });
+};
+
+// Removes top-level assignments of runtime.js and modules (statements before
+// offset end) which the rest of the program can't reach: their last key is
+// used nowhere in reachable code, or they assign to properties of a global
+// defined the same way which was removed. Other statements are reachable
+// from the start. Names built at runtime (o["ma" + "p"]) aren't seen, so
+// this is done only on request, for programs which don't use them. Returns
+// the remaining statements and names of removed definitions.
+var shake = function (ast, end) {
+  var used = {}, defined = {}, live = [], changed = true;
+  var targets = ast.map(function (statement) {
+    var target;
+    live.push(false);
+    if (statement.position() < end) {
+      target = assignmentTarget(statement);
+    }
+    if (target !== undefined) {
+      if (target.base === "global") {
+        defined[target.keys[0]] = true;
+      }
+    }
+    return target;
+  });
+  var needed = function (target) {
+    if (target === undefined) {
+      return true;
+    }
+    if (defined[target.base] === true) {
+      if (used[target.base] !== true) {
+        return false;
+      }
+    }
+    return !isPure(target.value) || used[target.keys[target.keys.length - 1]] === true;
+  };
+
+  runtimeNames.forEach(function (name) {
+    used[name] = true;
+  });
+  while (changed) {
+    changed = false;
+    ast.forEach(function (statement, i) {
+      if (!live[i]) {
+        if (needed(targets[i])) {
+          live[i] = true;
+          changed = true;
+          addUsedNames(statement, used);
+        }
+      }
+    });
+  }
+  var result = { ast: [], removed: [] };
+  ast.forEach(function (statement, i) {
+    if (live[i]) {
+      result.ast.push(statement);
+    } else {
+      result.removed.push([targets[i].base].concat(targets[i].keys).join("."));
+    }
+  });
+  return result;
+};
+
+exports.compile = function (input, dependencies, options) {
   if (typeof dependencies === "undefined") {
     dependencies = {};
   } else if (typeof dependencies === "string") {
@@ -29,23 +231,67 @@ exports.compile = function (input, dependencies) {
 
   var name;
   var sources = [];
+  options = options || {};
 
-  sources.push(readFile("src/runtime.js"));
+  sources.push({ file: "src/runtime.js", text: readFile("src/runtime.js") });
   for (name in dependencies) {
     if (dependencies.hasOwnProperty(name)) {
-      sources.push(asModule(name, readFile(dependencies[name])));
+      sources.push({ file: dependencies[name], text: asModule(name, readFile(dependencies[name])) });
     }
   }
-  sources.push(input);
+  // Workers (see Worker in js.c) run the same program, but start with the
+  // module given to them instead of the input.
+  sources.push({ file: "(worker)", text: "if (global.workerModule !== undefined) { " +
+    "global.require(global.workerModule); return undefined; }" });
+  sources.push({ file: options.inputFile || "(input)", text: input.toString() });
 
-  var ast = parser.parse(sources.join("\n")).success;
+  var program = sources.map(function (source) {
+    return source.text;
+  }).join("\n");
+  var ast = parser.parse(program, undefined, { positions: true }).success;
   if (! ast) {
     throw "Compilation failed: parse error";
   }
 
-  return backend.compile(ast);
+  // Definitions of runtime.js and modules nothing uses are left out when
+  // options.shake is true. Names of removed ones end up in options.removed.
+  if (options.shake === true) {
+    var shaken = shake(ast, sources.slice(0, sources.length - 2).reduce(function (end, source) {
+      return end + source.text.length + 1;
+    }, 0));
+    ast = shaken.ast;
+    options.removed = shaken.removed;
+  }
+
+  // Statements of runtime.js form the prelude, which can be replaced by a
+  // heap snapshot (see JS_SNAPSHOT in js.c).
+  options.preludeStatements = ast.filter(function (statement) {
+    return statement.position() < sources[0].text.length;
+  }).length;
+  options.locate = sourceLocator(sources);
+  // Code is specialized for types and branches seen in the given profile.
+  if (typeof options.feedback === "string") {
+    options.feedback = parseFeedback(readFile(options.feedback));
+  }
+  // Bytecode is run by the interpreter in js.c instead of being compiled to C.
+  if (options.bytecode) {
+    return bytecodeBackend.compile(ast, options);
+  }
+  return backend.compile(ast, options);
+};
+
+exports.compileFile = function (filename, dependencies, options) {
+  options = options || {};
+  options.inputFile = filename;
+  return exports.compile(readFile(filename), dependencies, options);
 };
 
-exports.compileFile = function (filename, dependencies) {
-  return exports.compile(readFile(filename), dependencies);
+// Compiles program into several translation units and writes them, together
+// with a Makefile, to given directory. The directory must already exist.
+exports.compileFileToDirectory = function (filename, dependencies, directory, options) {
+  options.root = pathBackFrom(directory);
+  options.functionsPerUnit = options.functionsPerUnit || 25;
+  exports.compileFile(filename, dependencies, options).forEach(function (file) {
+    fs.writeFileSync(directory + "/" + file[0], file[1]);
+  });
 };
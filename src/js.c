@@ -1,122 +1,84 @@
-#include <stdlib.h>
-#include <string.h>
-#include <setjmp.h>
-#include <stdarg.h>
-
-enum JSType {
-    TypeUndefined,
-    TypeNumber,
-    TypeString,
-    TypeBoolean,
-    TypeObject
-};
-
-typedef struct {
-    char* cstring;
-    unsigned int length;
-} JSString;
-
-typedef struct TJSValue {
-    enum JSType type;
-    union {
-        int number;
-        JSString string;
-        char boolean;
-        struct TJSObject* object;
-    } as;
-} JSValue;
-
-typedef unsigned int JSStringHash;
-
-typedef struct {
-    JSString key;
-    JSStringHash key_hash;
-    JSValue value;
-} JSProperty;
-
-enum JSObjectClass {
-    ClassObject,
-    ClassFunction,
-    ClassArray
-};
-
-typedef struct TJSObject {
-    enum JSObjectClass class;
-    JSProperty* properties;
-    unsigned short properties_count;
-    unsigned short properties_size;
-    struct TJSObject* prototype;
-    struct TJSValue primitive;
-    char gc_mark;
-} JSObject;
+#include "js.h"
 
-typedef struct {
-    JSObject as_object;
-    JSValue (*function)();
-    JSObject* binding;
-} JSFunctionObject;
-
-#define JS_CALL_STACK_SIZE 8192
-#define JS_EXCEPTION_STACK_SIZE 1024
-#define JS_GC_THRESHOLD 65536
-#define JS_GC_STACK_DEPTH 4096
+#include <limits.h>
+#include <sched.h>
 
-#define JS_CALL_STACK_ITEM(i) (env->call_stack[env->call_stack_count - stack_count + (i)])
-#define JS_CALL_STACK_PUSH(x) (env->call_stack[env->call_stack_count++] = (x))
-#define JS_CALL_STACK_POP     (env->call_stack_count -= stack_count)
-
-#define JS_IS_FUNCTION(x) (x.type == TypeObject && x.as.object && x.as.object->class == ClassFunction)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-typedef struct {
-    jmp_buf jmp;
-    JSValue value;
-} JSException;
+#ifdef JS_MMAP_FILES
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
-typedef struct {
-    JSValue global;
-    JSValue call_stack[JS_CALL_STACK_SIZE];
-    unsigned int call_stack_count;
-    JSException exceptions[JS_EXCEPTION_STACK_SIZE];
-    unsigned int exceptions_count;
-    JSObject** objects;
-    unsigned int objects_count;
-    unsigned int objects_size;
-    unsigned int gc_last_objects_count;
-} JSEnv;
-
-void js_throw(JSEnv* env, JSValue exception);
-JSValue js_call_function(JSEnv* env, JSValue v, JSValue this, int stack_count);
-JSValue js_call_method(JSEnv* env, JSValue object, JSValue key, int stack_count);
-JSValue js_invoke_constructor(JSEnv* env, JSValue function, int stack_count);
-
-void js_call_stack_push(JSEnv* env, JSValue value);
-void js_call_stack_pop(JSEnv* env);
-JSValue js_call_stack_pop_and_return(JSEnv* env, JSValue value);
-void js_check_call_stack_overflow(JSEnv* env, int n);
-
-static JSString string_from_cstring(char* cstring);
 static char* string_to_cstring(JSString string);
 static JSString string_char_at(JSString string, int index);
+static JSString string_slice(JSString string, int from, int to);
+static int string_find(JSString string, JSString search, int from);
+static int string_find_last(JSString string, JSString search, int from);
 static int string_cmp(JSString s1, JSString s2);
 static JSStringHash string_to_hash(JSString string);
 
-static JSObject* object_new(JSObject* prototype);
 static JSProperty* object_find_property(JSObject* object, JSString key);
 static JSProperty* object_find_own_property(JSObject* object, JSString key);
 static JSValue object_get_own_property(JSObject* object, JSString key);
 static JSValue object_get_property(JSObject* object, JSString key);
 static void object_set_property(JSObject* object, JSString key, JSValue value);
 
+static void for_in_keys_release(JSForInKeys* keys);
+
+JSValue js_worker_post_message(JSEnv* env, JSValue this, int stack_count, JSObject* binding);
+
 static JSFunctionObject* function_object_new(JSObject* prototype, JSValue (*function_ptr)(), JSObject* binding);
+static void function_prototype_materialize(JSEnv* env, JSObject* function);
+static JSValue bytecode_call(JSEnv* env, JSBytecodeFunction* function, JSValue this, int stack_count,
+    JSObject* parent_binding);
+
+#ifdef JS_PROFILE
+static unsigned int profile_depth(JSEnv* env);
+static void profile_unwind(JSEnv* env, unsigned int depth);
+#endif
 
-JSValue js_get_property(JSEnv* env, JSValue value, JSValue key);
-JSValue js_set_property(JSEnv* env, JSValue object, JSValue key, JSValue value);
-JSValue js_get_global(JSEnv* env, JSString key);
+#ifdef JS_ALLOC_PROFILE
+static void alloc_profile_object(JSEnv* env, JSObject* object);
+static void alloc_profile_collected(JSEnv* env, JSObject* object, int survived);
+static void alloc_profile_string(JSEnv* env, size_t bytes);
+#endif
 
-void js_gc_setup(JSEnv* env);
-void js_gc_save_object(JSEnv* env, JSObject* object);
-int js_gc_should_run(JSEnv* env);
-void js_gc_run(JSEnv* env, ...);
+// Counters of hot paths in builds with -DJS_STATS, see js_stats_setup. They
+// are kept per thread, because lookups and hashing don't know their
+// environment.
+#ifdef JS_STATS
+typedef struct {
+    unsigned long long property_lookups;
+    // own properties searched (by lookups and otherwise), properties compared
+    // or index slots probed while searching them
+    unsigned long long property_searches;
+    unsigned long long property_probes;
+    unsigned long long prototype_hops;
+    unsigned long long prototype_depth_max;
+    unsigned long long hashes;
+    unsigned long long hashed_bytes;
+    unsigned long long function_calls;
+    unsigned long long method_calls;
+    unsigned long long number_to_string;
+    unsigned long long concat_bytes;
+    unsigned long long try_blocks;
+    unsigned long long throws;
+    unsigned long long call_stack_peak;
+} JSStats;
+
+static __thread JSStats stats;
+
+#define JS_STATS_ADD(counter, n) (stats.counter += (n))
+#define JS_STATS_MAX(counter, n) do { \
+        if ((unsigned long long) (n) > stats.counter) stats.counter = (n); \
+    } while (0)
+#else
+#define JS_STATS_ADD(counter, n)
+#define JS_STATS_MAX(counter, n) do { } while (0)
+#endif
 
 // --- constructors for values ------------------------------------------------
 
@@ -153,12 +115,59 @@ JSValue js_object_value_from_object(JSObject* object) {
 }
 
 
+// Names of intrinsics, with the property of the global holding them.
+static struct {
+    char* global;
+    char* property;
+} intrinsic_names[IntrinsicsCount] = {
+    { "Object", "prototype" },
+    { "Function", "prototype" },
+    { "Array", NULL },
+    { "Number", NULL },
+    { "String", NULL },
+    { "TypeError", NULL },
+    { "ReferenceError", NULL },
+    { "SyntaxError", NULL },
+    { "ArrayBuffer", "prototype" },
+    { "Int32Array", "prototype" },
+    { "Uint8Array", "prototype" }
+};
+
+// Intrinsics are stored when native objects are created. The ones defined by
+// runtime.js, and all of them after loading a heap snapshot, are looked up by
+// name in js_resolve_intrinsics, or on first use if needed earlier. Like in
+// JS, reassigning a global later doesn't change them.
+static JSObject* intrinsic(JSEnv* env, JSIntrinsic id) {
+    if (env->intrinsics[id] == NULL) {
+        JSValue value = js_get_global(env, string_from_cstring(intrinsic_names[id].global));
+        if (intrinsic_names[id].property != NULL && value.type == TypeObject && value.as.object != NULL) {
+            value = js_get_property(env, value, js_string_value_from_cstring(intrinsic_names[id].property));
+        }
+        if (value.type != TypeObject || value.as.object == NULL) {
+            fprintf(stderr, "Built-in %s%s%s is not an object\n", intrinsic_names[id].global,
+                intrinsic_names[id].property != NULL ? "." : "",
+                intrinsic_names[id].property != NULL ? intrinsic_names[id].property : "");
+            exit(1);
+        }
+        env->intrinsics[id] = value.as.object;
+    }
+    return env->intrinsics[id];
+}
+
+static JSValue intrinsic_value(JSEnv* env, JSIntrinsic id) {
+    return js_object_value_from_object(intrinsic(env, id));
+}
+
+void js_resolve_intrinsics(JSEnv* env) {
+    int id;
+    for (id = 0; id < IntrinsicsCount; id++) {
+        intrinsic(env, id);
+    }
+}
+
 JSObject* js_construct_object(JSEnv* env) {
-    JSObject* object = object_new(NULL);
+    JSObject* object = object_new(intrinsic(env, IntrinsicObjectPrototype));
     js_gc_save_object(env, object);
-    object->prototype =
-        js_get_property(env, js_get_global(env, string_from_cstring("Object")),
-            js_string_value_from_cstring("prototype")).as.object;
     return object;
 }
 
@@ -167,21 +176,14 @@ JSValue js_construct_object_value(JSEnv* env) {
 }
 
 JSFunctionObject* js_construct_function_object(JSEnv* env, JSValue (*function_ptr)(), JSObject* binding) {
-    JSObject* function_object_prototype =
-        js_get_property(env, js_get_global(env, string_from_cstring("Function")),
-            js_string_value_from_cstring("prototype")).as.object;
+    JSObject* function_object_prototype = intrinsic(env, IntrinsicFunctionPrototype);
 
     JSFunctionObject* function_object = function_object_new(function_object_prototype, function_ptr, binding);
     js_gc_save_object(env, (JSObject*) function_object);
 
-    // every function has a prototype object for constructed instances
-    JSObject* instances_prototype = js_construct_object(env);
-    object_set_property(instances_prototype,
-        string_from_cstring("constructor"),
-        js_object_value_from_object((JSObject*) function_object));
-    object_set_property((JSObject*) function_object,
-        string_from_cstring("prototype"),
-        js_object_value_from_object(instances_prototype));
+    // every function has a prototype object for constructed instances, see
+    // function_prototype_materialize
+    ((JSObject*) function_object)->lazy_prototype = 1;
 
     return function_object;
 }
@@ -208,6 +210,7 @@ JSValue js_new_null() {
 JSValue js_to_string(JSEnv* env, JSValue v) {
     switch (v.type) {
         case TypeNumber:;
+            JS_STATS_ADD(number_to_string, 1);
             // TODO move to separate function
             char len = 1;
             int a = v.as.number;
@@ -269,10 +272,10 @@ JSValue js_to_object(JSEnv* env, JSValue v) {
         return v;
     } else if (v.type == TypeNumber) {
         JS_CALL_STACK_PUSH(v);
-        return js_invoke_constructor(env, js_get_global(env, string_from_cstring("Number")), 1);
+        return js_invoke_constructor(env, intrinsic_value(env, IntrinsicNumber), 1);
     } else if (v.type == TypeString) {
         JS_CALL_STACK_PUSH(v);
-        return js_invoke_constructor(env, js_get_global(env, string_from_cstring("String")), 1);
+        return js_invoke_constructor(env, intrinsic_value(env, IntrinsicString), 1);
     } else {
         fprintf(stderr, "Cannot convert to object");
         exit(1);
@@ -324,6 +327,10 @@ JSValue js_instanceof(JSEnv* env, JSValue left, JSValue right) {
         // TODO throw better exception
         js_throw(env, js_string_value_from_cstring("TypeError"));
     }
+    if (right.as.object->lazy_prototype) {
+        // nothing can inherit from a prototype which doesn't exist yet
+        return js_new_boolean(0);
+    }
     JSValue constructor_prototype = object_get_property(right.as.object, string_from_cstring("prototype"));
     if (constructor_prototype.type != TypeObject) {
         // TODO throw better exception
@@ -346,11 +353,15 @@ JSValue js_add(JSEnv* env, JSValue v1, JSValue v2) {
         v1 = js_to_string(env, v1);
         v2 = js_to_string(env, v2);
 
+        JS_STATS_ADD(concat_bytes, v1.as.string.length + v2.as.string.length + 1);
         // TODO js_string_concat
         char* new_cstring = malloc(sizeof(char) * (v1.as.string.length + v2.as.string.length + 1));
         memcpy(new_cstring, v1.as.string.cstring, v1.as.string.length);
         memcpy(new_cstring + v1.as.string.length, v2.as.string.cstring, v2.as.string.length);
         new_cstring[v1.as.string.length + v2.as.string.length] = '\0';
+#ifdef JS_ALLOC_PROFILE
+        alloc_profile_string(env, v1.as.string.length + v2.as.string.length + 1);
+#endif
         return js_string_value_from_cstring(new_cstring);
     } else {
         return js_new_number(js_to_number(env, v1).as.number + js_to_number(env, v2).as.number);
@@ -436,20 +447,43 @@ JSValue js_logical_or(JSEnv* env, JSValue v1, JSValue v2) {
 
 // --- function calls ---------------------------------------------------------
 
-JSValue js_call_function(JSEnv* env, JSValue v, JSValue this, int stack_count) {
+static JSValue call_function(JSEnv* env, JSValue v, JSValue this, int stack_count) {
     if (JS_IS_FUNCTION(v)) {
         JSFunctionObject* function_object = (JSFunctionObject*) v.as.object;
+        if (function_object->bytecode != NULL) {
+            return bytecode_call(env, function_object->bytecode, this, stack_count, function_object->binding);
+        }
         return (function_object->function)(env, this, stack_count, function_object->binding);
     } else {
         JSValue message = js_add(env, js_typeof(v), js_string_value_from_cstring(" is not a function."));
         JS_CALL_STACK_PUSH(message);
-        JSValue exception = js_invoke_constructor(env, js_get_global(env, string_from_cstring("TypeError")), 1);
+        JSValue exception = js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1);
         js_throw(env, exception);
     }
 }
 
-JSValue js_call_method(JSEnv* env, JSValue object, JSValue key, int stack_count) {
-    object = js_to_object(env, object);
+// Calls in tail position are left pending by the calling function (see
+// js_tail_call) and made here, after it has returned, so chains of tail calls
+// run in constant C stack.
+JSValue js_call_function(JSEnv* env, JSValue v, JSValue this, int stack_count) {
+    JS_STATS_ADD(function_calls, 1);
+    JSValue ret = call_function(env, v, this, stack_count);
+    while (env->tail_call) {
+        env->tail_call = 0;
+        ret = call_function(env, env->tail_callee, env->tail_this, env->tail_count);
+    }
+    return ret;
+}
+
+void js_tail_call(JSEnv* env, JSValue v, JSValue this, int stack_count) {
+    env->tail_call = 1;
+    env->tail_callee = v;
+    env->tail_this = this;
+    env->tail_count = stack_count;
+}
+
+// Object has to be converted with js_to_object.
+static JSValue method_lookup(JSEnv* env, JSValue object, JSValue key) {
     JSValue function = js_get_property(env, object, key);
     if (function.type == TypeUndefined) {
         // TypeError: Object #{object} has no method '#{key}'
@@ -462,7 +496,7 @@ JSValue js_call_method(JSEnv* env, JSValue object, JSValue key, int stack_count)
                 )
             );
         JS_CALL_STACK_PUSH(message);
-        JSValue exception = js_invoke_constructor(env, js_get_global(env, string_from_cstring("TypeError")), 1);
+        JSValue exception = js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1);
         js_throw(env, exception);
     }
     if (! JS_IS_FUNCTION(function)) {
@@ -476,20 +510,33 @@ JSValue js_call_method(JSEnv* env, JSValue object, JSValue key, int stack_count)
                 )
             );
         JS_CALL_STACK_PUSH(message);
-        JSValue exception = js_invoke_constructor(env, js_get_global(env, string_from_cstring("TypeError")), 1);
+        JSValue exception = js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1);
         js_throw(env, exception);
     }
-    return js_call_function(env, function, object, stack_count);
+    return function;
+}
+
+JSValue js_call_method(JSEnv* env, JSValue object, JSValue key, int stack_count) {
+    JS_STATS_ADD(method_calls, 1);
+    object = js_to_object(env, object);
+    return js_call_function(env, method_lookup(env, object, key), object, stack_count);
+}
+
+void js_tail_call_method(JSEnv* env, JSValue object, JSValue key, int stack_count) {
+    object = js_to_object(env, object);
+    js_tail_call(env, method_lookup(env, object, key), object, stack_count);
 }
 
 JSValue js_invoke_constructor(JSEnv* env, JSValue function, int stack_count) {
     JSValue this = js_construct_object_value(env);
+    function_prototype_materialize(env, function.as.object);
     JSValue constructor_prototype = object_get_property(function.as.object, string_from_cstring("prototype"));
     if (constructor_prototype.type == TypeObject) {
+        // the only way for a function to get into a prototype chain
+        function_prototype_materialize(env, constructor_prototype.as.object);
         this.as.object->prototype = constructor_prototype.as.object;
     } else {
-        this.as.object->prototype = js_get_property(env, js_get_global(env, string_from_cstring("Object")),
-            js_string_value_from_cstring("prototype")).as.object;
+        this.as.object->prototype = intrinsic(env, IntrinsicObjectPrototype);
     }
     JSValue ret = js_call_function(env, function, this, stack_count);
     if (ret.type == TypeObject) {
@@ -499,8 +546,34 @@ JSValue js_invoke_constructor(JSEnv* env, JSValue function, int stack_count) {
     }
 }
 
+void js_call_stack_setup(JSEnv* env) {
+    env->call_stack = malloc(sizeof(JSValue) * JS_CALL_STACK_SIZE);
+    env->call_stack_size = JS_CALL_STACK_SIZE;
+    env->call_stack_count = 0;
+}
+
+static void call_stack_grow(JSEnv* env, unsigned int size) {
+    if (size > JS_CALL_STACK_LIMIT) {
+        fprintf(stderr, "Call stack overflow: %d\n", size);
+        exit(1);
+    }
+    while (env->call_stack_size < size) {
+        env->call_stack_size *= 2;
+    }
+    if (env->call_stack_size > JS_CALL_STACK_LIMIT) {
+        env->call_stack_size = JS_CALL_STACK_LIMIT;
+    }
+    env->call_stack = realloc(env->call_stack, sizeof(JSValue) * env->call_stack_size);
+    if (env->call_stack == NULL) {
+        fprintf(stderr, "Call stack overflow: out of memory\n");
+        exit(1);
+    }
+}
+
 void js_call_stack_push(JSEnv* env, JSValue value) {
-    // env->call_stack_count++;
+    if (env->call_stack_count >= env->call_stack_size) {
+        call_stack_grow(env, env->call_stack_count + 1);
+    }
     env->call_stack[env->call_stack_count++] = value;
 }
 
@@ -513,10 +586,11 @@ JSValue js_call_stack_pop_and_return(JSEnv* env, JSValue value) {
     return value;
 }
 
+// Reserves room for n values pushed for a call.
 void js_check_call_stack_overflow(JSEnv* env, int n) {
-    if (env->call_stack_count + n >= JS_CALL_STACK_SIZE) {
-        fprintf(stderr, "Call stack overflow: %d\n", env->call_stack_count + n);
-        exit(1);
+    JS_STATS_MAX(call_stack_peak, env->call_stack_count + n);
+    if (env->call_stack_count + n > env->call_stack_size) {
+        call_stack_grow(env, env->call_stack_count + n);
     }
 }
 
@@ -543,12 +617,57 @@ JSValue js_get_variable_rvalue(JSEnv* env, JSObject* binding, JSString name) {
         } else {
             JSValue message = js_add(env, js_string_value_from_string(name), js_string_value_from_cstring(" is not defined."));
             JS_CALL_STACK_PUSH(message);
-            JSValue exception = js_invoke_constructor(env, js_get_global(env, string_from_cstring("ReferenceError")), 1);
+            JSValue exception = js_invoke_constructor(env, intrinsic_value(env, IntrinsicReferenceError), 1);
             js_throw(env, exception);
         }
     }
 }
 
+void js_global_cells_setup(JSEnv* env, char** names) {
+    unsigned int count = 0;
+    while (names[count] != NULL) count++;
+    env->global_names = names;
+    env->global_cells = calloc(count + 1, sizeof(unsigned int));
+}
+
+static unsigned int global_cell_find(JSEnv* env, unsigned int n) {
+    JSObject* global = env->global.as.object;
+    JSProperty* property = object_find_own_property(global, string_from_cstring(env->global_names[n]));
+    if (property != NULL) {
+        env->global_cells[n] = property - global->properties + 1;
+    }
+    return env->global_cells[n];
+}
+
+// Called when the cell is empty, i.e. the variable may not exist yet.
+JSValue js_resolve_global_cell(JSEnv* env, unsigned int n) {
+    if (global_cell_find(env, n)) {
+        return env->global.as.object->properties[env->global_cells[n] - 1].value;
+    }
+    JSValue message = js_add(env, js_string_value_from_cstring(env->global_names[n]), js_string_value_from_cstring(" is not defined."));
+    JS_CALL_STACK_PUSH(message);
+    JSValue exception = js_invoke_constructor(env, intrinsic_value(env, IntrinsicReferenceError), 1);
+    js_throw(env, exception);
+}
+
+JSValue js_set_global_cell(JSEnv* env, unsigned int n, JSValue value) {
+    JSObject* global = env->global.as.object;
+    if (env->global_cells[n] || global_cell_find(env, n)) {
+        global->properties[env->global_cells[n] - 1].value = value;
+    } else {
+        object_add_property(global, string_from_cstring(env->global_names[n]), value);
+        env->global_cells[n] = global->properties_count;
+    }
+    return value;
+}
+
+// Returns location of a variable declared in an enclosing scope. Bindings get
+// all their properties in the function prologue, so the location stays valid
+// as long as the scope exists.
+JSValue* js_variable_slot(JSObject* binding, JSString name) {
+    return &object_find_property(binding, name)->value;
+}
+
 // --- exceptions -------------------------------------------------------------
 
 JSException* js_push_new_exception(JSEnv *env) {
@@ -556,7 +675,13 @@ JSException* js_push_new_exception(JSEnv *env) {
         fprintf(stderr, "Exception stack overflow.\n");
         exit(1);
     }
+    JS_STATS_ADD(try_blocks, 1);
     env->exceptions_count++;
+    env->exceptions[env->exceptions_count - 1].call_stack_count = env->call_stack_count;
+    env->exceptions[env->exceptions_count - 1].for_in_count = env->for_in_count;
+#ifdef JS_PROFILE
+    env->exceptions[env->exceptions_count - 1].profile_depth = profile_depth(env);
+#endif
     return &env->exceptions[env->exceptions_count - 1];
 }
 
@@ -580,12 +705,23 @@ JSException* js_last_exception(JSEnv *env) {
 void js_throw(JSEnv* env, JSValue value) {
     JSException* exc = js_last_exception(env);
     exc->value = value;
+    // drop arguments of calls skipped by longjmp
+    env->call_stack_count = exc->call_stack_count;
+    // and for-in loops they left
+    while (env->for_in_count > exc->for_in_count) {
+        for_in_keys_release(env->for_in[--env->for_in_count]);
+    }
+#ifdef JS_PROFILE
+    // functions skipped by longjmp leave now
+    profile_unwind(env, exc->profile_depth);
+#endif
+    JS_STATS_ADD(throws, 1);
     longjmp(exc->jmp, 1);
 }
 
 // --- strings ----------------------------------------------------------------
 
-static JSString string_from_cstring(char* cstring) {
+JSString string_from_cstring(char* cstring) {
     JSString string;
     string.cstring = cstring;
     string.length = strlen(cstring);
@@ -620,10 +756,91 @@ static int string_cmp(JSString s1, JSString s2) {
     }
 }
 
+static JSString string_slice(JSString string, int from, int to) {
+    JSString new_string;
+    new_string.cstring = string.cstring + from;
+    new_string.length = to - from;
+    return new_string;
+}
+
+// Returns position of the first occurrence of search in string, starting at
+// from, or -1. Strings don't have to be terminated. With SSE2 (x86-64, or
+// -m32 -msse2 as in the Makefile), 16 positions at a time are compared
+// against the first and the last character of search, and only candidates
+// matching both are compared in full. Otherwise memchr looks for the first
+// character.
+static int string_find(JSString string, JSString search, int from) {
+    int last = (int) string.length - (int) search.length;
+    char* s = string.cstring;
+
+    if (from < 0) {
+        from = 0;
+    }
+    if (search.length == 0) {
+        return from < string.length ? from : string.length;
+    }
+#ifdef __SSE2__
+    {
+        __m128i first = _mm_set1_epi8(search.cstring[0]);
+        __m128i final = _mm_set1_epi8(search.cstring[search.length - 1]);
+        while (from + 15 <= last) {
+            __m128i block_first = _mm_loadu_si128((__m128i*) (s + from));
+            __m128i block_final = _mm_loadu_si128((__m128i*) (s + from + search.length - 1));
+            unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+                _mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(final, block_final)));
+            while (mask != 0) {
+                int i = from + __builtin_ctz(mask);
+                if (memcmp(s + i, search.cstring, search.length) == 0) {
+                    return i;
+                }
+                mask &= mask - 1;
+            }
+            from += 16;
+        }
+    }
+#endif
+    while (from <= last) {
+        char* candidate = memchr(s + from, search.cstring[0], last - from + 1);
+        if (candidate == NULL) {
+            return -1;
+        }
+        if (memcmp(candidate, search.cstring, search.length) == 0) {
+            return candidate - s;
+        }
+        from = candidate - s + 1;
+    }
+    return -1;
+}
+
+// Returns position of the last occurrence of search in string, starting at
+// from or before, or -1.
+static int string_find_last(JSString string, JSString search, int from) {
+    int last = (int) string.length - (int) search.length;
+
+    if (from < 0) {
+        from = 0;
+    }
+    if (from > last) {
+        from = last;
+    }
+    if (search.length == 0) {
+        return from;
+    }
+    for (; from >= 0; from--) {
+        if (string.cstring[from] == search.cstring[0] &&
+                memcmp(string.cstring + from, search.cstring, search.length) == 0) {
+            return from;
+        }
+    }
+    return -1;
+}
+
 // FNV-1a hash, see http://isthe.com/chongo/tech/comp/fnv/
 static JSStringHash string_to_hash(JSString string) {
     int i = 0;
     unsigned int result = 2166136261u;
+    JS_STATS_ADD(hashes, 1);
+    JS_STATS_ADD(hashed_bytes, string.length);
     while (i < string.length) {
         result ^= string.cstring[i];
         result *= 16777619u;
@@ -639,9 +856,16 @@ static JSObject* object_alloc() {
 }
 
 static void object_destroy(JSObject* object) {
+    if (object->class == ClassArrayBuffer) {
+        free(((JSBufferObject*) object)->data);
+    }
     if (object->properties) {
         free(object->properties);
     }
+    if (object->index) {
+        free(object->index);
+    }
+    for_in_keys_release(object->for_in_keys);
     free(object);
 }
 
@@ -649,19 +873,39 @@ static JSObject* object_init(JSObject* object, JSObject* prototype) {
     object->properties = NULL;
     object->properties_count = 0;
     object->properties_size = 0;
+    object->index = NULL;
+    object->for_in_keys = NULL;
     object->prototype = prototype;
+    object->primitive.type = TypeUndefined;
+    object->lazy_prototype = 0;
     object->class = ClassObject;
     return object;
 }
 
-static JSObject* object_new(JSObject* prototype) {
+JSObject* object_new(JSObject* prototype) {
     return object_init(object_alloc(), prototype);
 }
 
 static JSProperty* object_find_own_property_with_hash(JSObject* object, JSString key, JSStringHash key_hash) {
-    int i = 0;
+    JS_STATS_ADD(property_searches, 1);
+    if (object->index != NULL) {
+        unsigned int mask = object->properties_size * 2 - 1;
+        unsigned int slot = key_hash & mask;
+        while (object->index[slot] != 0) {
+            JSProperty* prop = object->properties + object->index[slot] - 1;
+            JS_STATS_ADD(property_probes, 1);
+            if (prop->key_hash == key_hash && string_cmp(prop->key, key) == 0) {
+                return prop;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return NULL;
+    }
+
+    unsigned int i = 0;
     while (i < object->properties_count) {
         JSProperty* prop = object->properties + i;
+        JS_STATS_ADD(property_probes, 1);
         if (prop->key_hash == key_hash && string_cmp(prop->key, key) == 0) {
             return prop;
         } else {
@@ -677,15 +921,27 @@ static JSProperty* object_find_own_property(JSObject* object, JSString key) {
 
 static JSProperty* object_find_property(JSObject* object, JSString key) {
     JSStringHash key_hash = string_to_hash(key);
+#ifdef JS_STATS
+    unsigned int depth = 0;
+    stats.property_lookups++;
+#endif
 
     while (object != NULL) {
         JSProperty* prop = object_find_own_property_with_hash(object, key, key_hash);
         if (prop != NULL) {
+            JS_STATS_MAX(prototype_depth_max, depth);
             return prop;
         } else {
             object = object->prototype;
+#ifdef JS_STATS
+            if (object != NULL) {
+                stats.prototype_hops++;
+                depth++;
+            }
+#endif
         }
     }
+    JS_STATS_MAX(prototype_depth_max, depth);
     return NULL;
 }
 
@@ -711,8 +967,28 @@ static JSValue object_get_property(JSObject* object, JSString key) {
     }
 }
 
+static void object_index_insert(JSObject* object, unsigned int i) {
+    unsigned int mask = object->properties_size * 2 - 1;
+    unsigned int slot = object->properties[i].key_hash & mask;
+    while (object->index[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    object->index[slot] = i + 1;
+}
+
+// Index has twice as many slots as there is room for properties, so it's
+// rebuilt whenever properties array grows.
+static void object_index_rebuild(JSObject* object) {
+    unsigned int i;
+    free(object->index);
+    object->index = calloc(object->properties_size * 2, sizeof(unsigned int));
+    for (i = 0; i < object->properties_count; i++) {
+        object_index_insert(object, i);
+    }
+}
+
 // Faster than object_set_property, because it doesn't check whether property exists.
-static void object_add_property(JSObject* object, JSString key, JSValue value) {
+void object_add_property(JSObject* object, JSString key, JSValue value) {
     if (object->properties_count >= object->properties_size) {
         if (object->properties_size == 0) {
             object->properties_size = 1;
@@ -720,12 +996,18 @@ static void object_add_property(JSObject* object, JSString key, JSValue value) {
             object->properties_size *= 2;
         }
         object->properties = realloc(object->properties, sizeof(JSProperty) * object->properties_size);
+        if (object->properties_size > JS_DICTIONARY_THRESHOLD) {
+            object_index_rebuild(object);
+        }
     }
     JSProperty* prop = &object->properties[object->properties_count];
     prop->key = key;
     prop->key_hash = string_to_hash(key);
     prop->value = value;
     object->properties_count++;
+    if (object->index != NULL) {
+        object_index_insert(object, object->properties_count - 1);
+    }
 }
 
 static void object_set_property(JSObject* object, JSString key, JSValue value) {
@@ -738,6 +1020,45 @@ static void object_set_property(JSObject* object, JSString key, JSValue value) {
     }
 }
 
+// Makes room for count more properties at once, so that adding them doesn't
+// grow the arrays step by step.
+static void object_reserve(JSObject* object, unsigned int count) {
+    unsigned int size = object->properties_size > 0 ? object->properties_size : 1;
+    while (size < object->properties_count + count) {
+        size *= 2;
+    }
+    if (size == object->properties_size) return;
+    object->properties = realloc(object->properties, sizeof(JSProperty) * size);
+    object->properties_size = size;
+    if (size > JS_DICTIONARY_THRESHOLD) {
+        object_index_rebuild(object);
+    }
+}
+
+// Turns an object without properties into an array of given values. Keys of
+// elements share one buffer.
+static void array_fill(JSObject* array, JSValue* values, unsigned int count) {
+    unsigned int i, n, digits = 0;
+    char* keys = NULL;
+    for (i = 0; i < count; i++) {
+        n = i;
+        do { digits++; n /= 10; } while (n > 0);
+    }
+    if (count > 0) {
+        keys = malloc(sizeof(char) * (digits + count));
+    }
+    object_reserve(array, count + 1);
+    for (i = 0; i < count; i++) {
+        JSString key;
+        key.cstring = keys;
+        key.length = sprintf(keys, "%u", i);
+        keys += key.length + 1;
+        object_add_property(array, key, values[i]);
+    }
+    object_add_property(array, string_from_cstring("length"), js_new_number(count));
+    array->class = ClassArray;
+}
+
 // --- function objects -------------------------------------------------------
 
 static JSFunctionObject* function_object_alloc() {
@@ -750,9 +1071,240 @@ static JSFunctionObject* function_object_new(JSObject* prototype, JSValue (*func
     ((JSObject*) object)->class = ClassFunction;
     object->function = function_ptr;
     object->binding = binding;
+    object->bytecode = NULL;
+    return object;
+}
+
+// Functions get their prototype object, with a constructor property pointing
+// back, when it's first needed, so closures which are only called cost a
+// single allocation. Until then a function has no own properties, and places
+// which could observe them materialize the prototype first.
+static void function_prototype_materialize(JSEnv* env, JSObject* function) {
+    if (function == NULL || !function->lazy_prototype) {
+        return;
+    }
+    function->lazy_prototype = 0;
+    JSObject* instances_prototype = js_construct_object(env);
+    object_add_property(instances_prototype,
+        string_from_cstring("constructor"), js_object_value_from_object(function));
+    object_add_property(function,
+        string_from_cstring("prototype"), js_object_value_from_object(instances_prototype));
+}
+
+static int is_prototype_key(JSString key) {
+    return key.length == 9 && memcmp(key.cstring, "prototype", 9) == 0;
+}
+
+// Assigning the prototype makes the default one unnecessary. Other properties
+// come after it, as if it had been created with the function.
+static void function_prepare_set_property(JSEnv* env, JSObject* function, JSString key) {
+    if (is_prototype_key(key)) {
+        function->lazy_prototype = 0;
+    } else {
+        function_prototype_materialize(env, function);
+    }
+}
+
+// --- typed arrays -----------------------------------------------------------
+
+// Elements of typed arrays aren't properties: js_get_property and
+// js_set_property read and write them in place.
+
+#define JS_IS_BUFFER_OBJECT(object) ((object)->class >= ClassArrayBuffer)
+
+static unsigned int typed_array_element_size(JSObject* object) {
+    return object->class == ClassInt32Array ? sizeof(int) : 1;
+}
+
+static JSBufferObject* buffer_object_new(JSEnv* env, enum JSObjectClass class, JSIntrinsic prototype,
+        unsigned char* data, unsigned int length, JSObject* buffer) {
+    JSBufferObject* object = malloc(sizeof(JSBufferObject));
+    object_init((JSObject*) object, intrinsic(env, prototype));
+    ((JSObject*) object)->class = class;
+    object->data = data;
+    object->length = length;
+    object->buffer = buffer;
+    js_gc_save_object(env, (JSObject*) object);
     return object;
 }
 
+// Takes ownership of data, which must have been allocated with malloc.
+static JSBufferObject* array_buffer_new(JSEnv* env, unsigned char* data, unsigned int length) {
+    env->buffer_bytes += length;
+    return buffer_object_new(env, ClassArrayBuffer, IntrinsicArrayBufferPrototype, data, length, NULL);
+}
+
+static JSBufferObject* typed_array_new(JSEnv* env, enum JSObjectClass class, JSBufferObject* buffer,
+        unsigned int offset, unsigned int length) {
+    JSIntrinsic prototype = IntrinsicUint8ArrayPrototype;
+    if (class == ClassInt32Array) prototype = IntrinsicInt32ArrayPrototype;
+    return buffer_object_new(env, class, prototype, buffer->data + offset, length, (JSObject*) buffer);
+}
+
+static int is_key(JSValue key, char* name) {
+    return key.type == TypeString && string_cmp(key.as.string, string_from_cstring(name)) == 0;
+}
+
+// Element index for numbers and canonical numeric strings, -1 for other keys.
+// Numeric keys which can't be indices (negative, "-0", too large, "NaN")
+// give INT_MAX, so they are out of range: reads give undefined and writes are
+// dropped, like in JS.
+static int typed_array_index(JSValue key) {
+    unsigned int i, start = 0;
+    int index = 0;
+    JSString string = key.as.string;
+    if (key.type == TypeNumber) {
+        return key.as.number < 0 ? INT_MAX : key.as.number;
+    }
+    if (key.type != TypeString || string.length == 0) {
+        return -1;
+    }
+    if (is_key(key, "NaN") || is_key(key, "Infinity") || is_key(key, "-Infinity") || is_key(key, "-0")) {
+        return INT_MAX;
+    }
+    if (string.cstring[0] == '-') {
+        start = 1;
+    }
+    if (string.length == start || (string.length > start + 1 && string.cstring[start] == '0')) {
+        return -1;
+    }
+    for (i = start; i < string.length; i++) {
+        char c = string.cstring[i];
+        if (c < '0' || c > '9') return -1;
+        if (i - start >= 9) {
+            index = INT_MAX;
+        } else {
+            index = index * 10 + (c - '0');
+        }
+    }
+    return start == 0 ? index : INT_MAX;
+}
+
+// Stores in result and returns 1 when the key is an element or a built-in
+// property of the object, returns 0 if it should be looked up as a property.
+static int buffer_object_get(JSObject* object, JSValue key, JSValue* result) {
+    JSBufferObject* buffer = (JSBufferObject*) object;
+    int index;
+    if (object->class == ClassArrayBuffer) {
+        if (!is_key(key, "byteLength")) return 0;
+        *result = js_new_number(buffer->length);
+        return 1;
+    }
+    index = typed_array_index(key);
+    if (index >= 0) {
+        if (index >= buffer->length) {
+            *result = js_new_undefined();
+        } else if (object->class == ClassInt32Array) {
+            *result = js_new_number(((int*) buffer->data)[index]);
+        } else {
+            *result = js_new_number(buffer->data[index]);
+        }
+    } else if (is_key(key, "length")) {
+        *result = js_new_number(buffer->length);
+    } else if (is_key(key, "byteLength")) {
+        *result = js_new_number(buffer->length * typed_array_element_size(object));
+    } else if (is_key(key, "byteOffset")) {
+        *result = js_new_number(buffer->data - ((JSBufferObject*) buffer->buffer)->data);
+    } else if (is_key(key, "buffer")) {
+        *result = js_object_value_from_object(buffer->buffer);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+// Numbers are stored modulo 2^8 in Uint8Array; values other than numbers and
+// booleans are stored as 0. Returns 0 if the key isn't an element index.
+// Writes past the end are ignored.
+static int buffer_object_set(JSObject* object, JSValue key, JSValue value) {
+    JSBufferObject* buffer = (JSBufferObject*) object;
+    int index, number = 0;
+    if (object->class == ClassArrayBuffer) return 0;
+    index = typed_array_index(key);
+    if (index < 0) return 0;
+    if (index < buffer->length) {
+        if (value.type == TypeNumber) {
+            number = value.as.number;
+        } else if (value.type == TypeBoolean) {
+            number = value.as.boolean;
+        }
+        if (object->class == ClassInt32Array) {
+            ((int*) buffer->data)[index] = number;
+        } else {
+            buffer->data[index] = number;
+        }
+    }
+    return 1;
+}
+
+static void typed_array_fail(JSEnv* env, char* message) {
+    JS_CALL_STACK_PUSH(js_string_value_from_cstring(message));
+    js_throw(env, js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1));
+}
+
+static int typed_array_argument(JSEnv* env, JSValue value, int default_value) {
+    if (value.type == TypeUndefined) return default_value;
+    return js_to_number(env, value).as.number;
+}
+
+// new ArrayBuffer(byteLength) allocates zeroed memory.
+JSValue js_array_buffer_constructor(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    int length = typed_array_argument(env, stack_count > 0 ? JS_CALL_STACK_ITEM(0) : js_new_undefined(), 0);
+    JS_CALL_STACK_POP;
+    if (length < 0) typed_array_fail(env, "Invalid array buffer length");
+    return js_object_value_from_object((JSObject*) array_buffer_new(env, calloc(length + 1, 1), length));
+}
+
+// Typed arrays are constructed with a length, from an array-like object whose
+// elements are copied, or as a view of ArrayBuffer (buffer, byteOffset,
+// length).
+static JSValue typed_array_construct(JSEnv* env, enum JSObjectClass class, int stack_count) {
+    JSValue source = stack_count > 0 ? JS_CALL_STACK_ITEM(0) : js_new_undefined();
+    JSValue offset_value = stack_count > 1 ? JS_CALL_STACK_ITEM(1) : js_new_undefined();
+    JSValue length_value = stack_count > 2 ? JS_CALL_STACK_ITEM(2) : js_new_undefined();
+    unsigned int size = class == ClassInt32Array ? sizeof(int) : 1;
+    JSBufferObject* buffer;
+    JSBufferObject* array;
+    int offset = 0, length, i;
+    JS_CALL_STACK_POP;
+
+    if (source.type == TypeObject && source.as.object != NULL && source.as.object->class == ClassArrayBuffer) {
+        buffer = (JSBufferObject*) source.as.object;
+        offset = typed_array_argument(env, offset_value, 0);
+        if (offset < 0 || offset > buffer->length || offset % size != 0) {
+            typed_array_fail(env, "Invalid typed array offset");
+        }
+        length = typed_array_argument(env, length_value, (buffer->length - offset) / size);
+        if (length < 0 || length > (buffer->length - offset) / size) {
+            typed_array_fail(env, "Invalid typed array length");
+        }
+        return js_object_value_from_object((JSObject*) typed_array_new(env, class, buffer, offset, length));
+    }
+
+    if (source.type == TypeObject && source.as.object != NULL) {
+        length = typed_array_argument(env, js_get_property(env, source, js_string_value_from_cstring("length")), 0);
+    } else {
+        length = typed_array_argument(env, source, 0);
+    }
+    if (length < 0 || length > INT_MAX / size) typed_array_fail(env, "Invalid typed array length");
+    buffer = array_buffer_new(env, calloc(length * size + 1, 1), length * size);
+    array = typed_array_new(env, class, buffer, 0, length);
+    if (source.type == TypeObject && source.as.object != NULL) {
+        for (i = 0; i < length; i++) {
+            buffer_object_set((JSObject*) array, js_new_number(i), js_get_property(env, source, js_new_number(i)));
+        }
+    }
+    return js_object_value_from_object((JSObject*) array);
+}
+
+JSValue js_int32_array_constructor(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    return typed_array_construct(env, ClassInt32Array, stack_count);
+}
+
+JSValue js_uint8_array_constructor(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    return typed_array_construct(env, ClassUint8Array, stack_count);
+}
+
 // --- properties -------------------------------------------------------------
 
 JSValue js_get_property(JSEnv* env, JSValue value, JSValue key) {
@@ -764,7 +1316,7 @@ JSValue js_get_property(JSEnv* env, JSValue value, JSValue key) {
                     js_add(env, js_string_value_from_cstring("Cannot read property '"),
                         js_add(env, js_to_string(env, key), js_string_value_from_cstring("' of undefined")));
                 JS_CALL_STACK_PUSH(message);
-                JSValue exception = js_invoke_constructor(env, js_get_global(env, string_from_cstring("TypeError")), 1);
+                JSValue exception = js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1);
                 js_throw(env, exception);
             }
             break;
@@ -787,13 +1339,36 @@ JSValue js_get_property(JSEnv* env, JSValue value, JSValue key) {
         case TypeBoolean:
             return js_get_property(env, js_to_object(env, value), js_to_string(env, key));
         case TypeObject:
-            return object_get_property(value.as.object, js_to_string(env, key).as.string);
+            if (JS_UNLIKELY(value.as.object == NULL)) {
+                // null has no properties
+                return js_new_undefined();
+            }
+            if (JS_UNLIKELY(JS_IS_BUFFER_OBJECT(value.as.object))) {
+                JSValue result;
+                if (buffer_object_get(value.as.object, key, &result)) {
+                    return result;
+                }
+            }
+            key = js_to_string(env, key);
+            if (value.as.object->lazy_prototype && is_prototype_key(key.as.string)) {
+                function_prototype_materialize(env, value.as.object);
+            }
+            return object_get_property(value.as.object, key.as.string);
     }
 }
 
 JSValue js_set_property(JSEnv* env, JSValue object, JSValue key, JSValue value) {
     object = js_to_object(env, object);
-    object_set_property(object.as.object, js_to_string(env, key).as.string, value);
+    if (object.as.object != NULL) {
+        if (JS_UNLIKELY(JS_IS_BUFFER_OBJECT(object.as.object)) && buffer_object_set(object.as.object, key, value)) {
+            return value;
+        }
+    }
+    JSString key_string = js_to_string(env, key).as.string;
+    if (object.as.object != NULL && object.as.object->lazy_prototype) {
+        function_prepare_set_property(env, object.as.object, key_string);
+    }
+    object_set_property(object.as.object, key_string, value);
 
     if (object.as.object->class == ClassArray && key.type == TypeNumber) {
         int length = js_to_number(env, object_get_property(object.as.object,
@@ -811,121 +1386,2286 @@ JSValue js_add_property(JSEnv* env, JSValue object, JSValue key, JSValue value)
     return object;
 }
 
+// Repeated keys keep the position of their first occurrence. Layouts are
+// shared by threads: the first one to store positions fills in the rest and
+// publishes the template last. Others free their copy and wait for it.
+static JSProperty* object_layout_build(JSObjectLayout* layout) {
+    unsigned int i, j, count = 0;
+    unsigned int* expected = NULL;
+    JSProperty* properties = malloc(sizeof(JSProperty) * layout->count);
+    unsigned int* positions = malloc(sizeof(unsigned int) * layout->count);
+    for (i = 0; i < layout->count; i++) {
+        JSString key = string_from_cstring(layout->keys[i]);
+        JSStringHash hash = string_to_hash(key);
+        for (j = 0; j < count; j++) {
+            if (properties[j].key_hash == hash && string_cmp(properties[j].key, key) == 0) {
+                break;
+            }
+        }
+        if (j == count) {
+            properties[count].key = key;
+            properties[count].key_hash = hash;
+            properties[count].value = js_new_undefined();
+            count++;
+        }
+        positions[i] = j;
+    }
+    if (!__atomic_compare_exchange_n(&layout->positions, &expected, positions, 0,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(properties);
+        free(positions);
+        while ((properties = __atomic_load_n(&layout->properties, __ATOMIC_ACQUIRE)) == NULL) {
+            sched_yield();
+        }
+        return properties;
+    }
+    layout->properties_count = count;
+    __atomic_store_n(&layout->properties, properties, __ATOMIC_RELEASE);
+    return properties;
+}
+
+// Creates the object of an object literal with all its properties at once.
+// Values are on the call stack, in the order of layout's keys.
+JSValue js_new_object_literal(JSEnv* env, JSObjectLayout* layout, int stack_count) {
+    unsigned int i, size = 1;
+    JSProperty* properties = __atomic_load_n(&layout->properties, __ATOMIC_ACQUIRE);
+    if (properties == NULL) {
+        properties = object_layout_build(layout);
+    }
+    while (size < layout->properties_count) {
+        size *= 2;
+    }
+    JSObject* object = js_construct_object(env);
+    object->properties = malloc(sizeof(JSProperty) * size);
+    object->properties_size = size;
+    object->properties_count = layout->properties_count;
+    memcpy(object->properties, properties, sizeof(JSProperty) * layout->properties_count);
+    for (i = 0; i < layout->count; i++) {
+        object->properties[layout->positions[i]].value = JS_CALL_STACK_ITEM(i);
+    }
+    if (size > JS_DICTIONARY_THRESHOLD) {
+        object_index_rebuild(object);
+    }
+    JS_CALL_STACK_POP;
+    return js_object_value_from_object(object);
+}
+
 JSValue js_get_global(JSEnv* env, JSString key) {
     return object_get_property(env->global.as.object, key);
 }
 
-// --- garbage collection -----------------------------------------------------
+// --- for-in enumeration -----------------------------------------------------
 
-void js_gc_setup(JSEnv* env) {
-    env->objects = malloc(sizeof(JSObject*) * 1024);
-    env->objects_size = 1024;
-    env->objects_count = 0;
-    env->gc_last_objects_count = 0;
-}
+// for-in loops iterate over a snapshot of keys, so the loop body may modify
+// the object. Snapshots are cached on objects. Properties are never removed,
+// so a snapshot is valid as long as the object has the same number of
+// properties and the snapshot of its prototype is still valid. Objects
+// sharing a prototype share its snapshot.
 
-void js_gc_save_object(JSEnv* env, JSObject* object) {
-    if (env->objects_count >= env->objects_size) {
-        env->objects_size *= 2;
-        env->objects = realloc(env->objects, sizeof(JSObject) * env->objects_size);
+static void for_in_keys_release(JSForInKeys* keys) {
+    while (keys != NULL && --keys->refs == 0) {
+        JSForInKeys* parent = keys->parent;
+        free(keys->keys);
+        free(keys);
+        keys = parent;
     }
-    env->objects[env->objects_count] = object;
-    env->objects_count++;
 }
 
-static void gc_stack_push(JSObject* stack[], int* stack_counter, JSObject* object) {
-    if (object == NULL) return;
-    if (object->gc_mark) return;
-    if (*stack_counter >= JS_GC_STACK_DEPTH) {
-        fprintf(stderr, "GC failed: stack overflow\n");
-        exit(0);
+static JSForInKeys* for_in_keys(JSObject* object) {
+    JSForInKeys* parent;
+    JSForInKeys* keys;
+    unsigned int i;
+
+    if (object == NULL) {
+        return NULL;
     }
-    stack[*stack_counter] = object;
-    // *stack_counter = *stack_counter + 1;
-    (*stack_counter)++;
-    object->gc_mark = 1;
-    return;
+    parent = for_in_keys(object->prototype);
+    keys = object->for_in_keys;
+    if (keys != NULL && keys->properties_count == object->properties_count && keys->parent == parent) {
+        return keys;
+    }
+
+    keys = malloc(sizeof(JSForInKeys));
+    keys->refs = 1;
+    keys->properties_count = object->properties_count;
+    keys->parent = parent;
+    keys->count = 0;
+    keys->keys = malloc(sizeof(JSString) * (object->properties_count + (parent ? parent->count : 0)));
+    for (i = 0; i < object->properties_count; i++) {
+        keys->keys[keys->count++] = object->properties[i].key;
+    }
+    if (parent != NULL) {
+        parent->refs++;
+        for (i = 0; i < parent->count; i++) {
+            if (!object_has_own_property(object, parent->keys[i])) {
+                keys->keys[keys->count++] = parent->keys[i];
+            }
+        }
+    }
+    for_in_keys_release(object->for_in_keys);
+    object->for_in_keys = keys;
+    return keys;
+}
+
+// Returns keys to iterate over, or NULL for null. The loop keeps a reference,
+// so that the snapshot survives changes or collection of the object, until
+// js_for_in_end or an exception leaving the loop.
+JSForInKeys* js_for_in_begin(JSEnv* env, JSValue value) {
+    value = js_to_object(env, value);
+    function_prototype_materialize(env, value.as.object);
+    JSForInKeys* keys = for_in_keys(value.as.object);
+    if (keys != NULL) {
+        keys->refs++;
+        if (env->for_in_count >= env->for_in_size) {
+            env->for_in_size = env->for_in_size ? 2 * env->for_in_size : 16;
+            env->for_in = realloc(env->for_in, sizeof(JSForInKeys*) * env->for_in_size);
+        }
+        env->for_in[env->for_in_count++] = keys;
+    }
+    return keys;
+}
+
+// Loops usually end innermost first, so keys are searched from the top.
+void js_for_in_end(JSEnv* env, JSForInKeys* keys) {
+    unsigned int i = env->for_in_count;
+    if (keys == NULL) {
+        return;
+    }
+    while (i > 0 && env->for_in[i - 1] != keys) {
+        i--;
+    }
+    if (i > 0) {
+        memmove(&env->for_in[i - 1], &env->for_in[i], sizeof(JSForInKeys*) * (env->for_in_count - i));
+        env->for_in_count--;
+    }
+    for_in_keys_release(keys);
+}
+
+// --- switch statements ------------------------------------------------------
+
+// Slots hold positions of labels plus one (zero is an empty slot). When a
+// label is repeated, only its first occurrence is inserted. Tables are shared
+// by threads: slots are published last, and threads which build the same
+// table at once produce identical contents.
+static int* switch_table_build(JSSwitchTable* table, char** cases, unsigned int count) {
+    unsigned int i, mask, slot, size = 2;
+    while (size < 2 * count) {
+        size *= 2;
+    }
+    mask = size - 1;
+    int* slots = calloc(size, sizeof(int));
+    JSStringHash* hashes = calloc(size, sizeof(JSStringHash));
+    for (i = 0; i < count; i++) {
+        JSString label = string_from_cstring(cases[i]);
+        JSStringHash hash = string_to_hash(label);
+        slot = hash & mask;
+        while (slots[slot] != 0 && !(hashes[slot] == hash &&
+                string_cmp(string_from_cstring(cases[slots[slot] - 1]), label) == 0)) {
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot] == 0) {
+            slots[slot] = i + 1;
+            hashes[slot] = hash;
+        }
+    }
+    table->size = size;
+    table->hashes = hashes;
+    __atomic_store_n(&table->slots, slots, __ATOMIC_RELEASE);
+    return slots;
+}
+
+// Returns position of the label equal to value, or -1.
+int js_switch_string(JSSwitchTable* table, char** cases, unsigned int count, JSValue value) {
+    unsigned int mask, slot;
+    JSStringHash hash;
+
+    if (value.type != TypeString) {
+        return -1;
+    }
+    int* slots = __atomic_load_n(&table->slots, __ATOMIC_ACQUIRE);
+    if (slots == NULL) {
+        slots = switch_table_build(table, cases, count);
+    }
+    hash = string_to_hash(value.as.string);
+    mask = table->size - 1;
+    slot = hash & mask;
+    while (slots[slot] != 0) {
+        int i = slots[slot] - 1;
+        if (table->hashes[slot] == hash && string_cmp(string_from_cstring(cases[i]), value.as.string) == 0) {
+            return i;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+// --- garbage collection -----------------------------------------------------
+
+static unsigned long long clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Environment whose statistics are printed at exit, if JS_GC_STATS is set.
+static JSEnv* gc_reported_env = NULL;
+
+static void gc_print_stats_at_exit() {
+    js_gc_print_stats(gc_reported_env, stderr);
+}
+
+void js_gc_setup(JSEnv* env) {
+    env->objects = malloc(sizeof(JSObject*) * 1024);
+    env->objects_size = 1024;
+    env->objects_count = 0;
+    env->gc_last_objects_count = 0;
+    env->buffer_bytes = 0;
+    env->gc_last_buffer_bytes = 0;
+    env->gc_mark_stack_size = JS_GC_STACK_DEPTH;
+    if (env->gc_mark_stack_size > JS_GC_STACK_LIMIT) {
+        env->gc_mark_stack_size = JS_GC_STACK_LIMIT;
+    }
+    env->gc_mark_stack = malloc(sizeof(JSObject*) * env->gc_mark_stack_size);
+    env->gc_mark_stack_count = 0;
+    env->gc_mark_overflow = 0;
+    env->alloc_profile = NULL;
+    env->alloc_site = 0;
+    memset(&env->gc_stats, 0, sizeof(JSGCStats));
+    env->gc_stats.trigger = "none";
+
+    if (getenv("JS_GC_STATS") && gc_reported_env == NULL) {
+        gc_reported_env = env;
+        atexit(gc_print_stats_at_exit);
+    }
+}
+
+void js_gc_save_object(JSEnv* env, JSObject* object) {
+    if (env->objects_count >= env->objects_size) {
+        env->objects_size *= 2;
+        env->objects = realloc(env->objects, sizeof(JSObject*) * env->objects_size);
+    }
+    env->objects[env->objects_count] = object;
+    env->objects_count++;
+#ifdef JS_ALLOC_PROFILE
+    alloc_profile_object(env, object);
+#endif
+}
+
+static size_t gc_property_bytes(JSObject* object) {
+    if (object->index != NULL) {
+        return (sizeof(JSProperty) + 2 * sizeof(unsigned int)) * object->properties_size;
+    }
+    return sizeof(JSProperty) * object->properties_size;
+}
+
+static size_t gc_object_bytes(JSObject* object) {
+    if (object->class == ClassFunction) {
+        return sizeof(JSFunctionObject) + gc_property_bytes(object);
+    }
+    if (object->class == ClassArrayBuffer) {
+        return sizeof(JSBufferObject) + ((JSBufferObject*) object)->length + gc_property_bytes(object);
+    }
+    if (JS_IS_BUFFER_OBJECT(object)) {
+        return sizeof(JSBufferObject) + gc_property_bytes(object);
+    }
+    return sizeof(JSObject) + gc_property_bytes(object);
+}
+
+// Marks object and pushes it to the mark stack, to scan its references later.
+// The stack grows up to JS_GC_STACK_LIMIT entries. When it's full, the object
+// is only marked and gc_mark_overflow tells gc_mark_all() to find marked
+// objects with unmarked references by scanning the whole heap.
+static void gc_mark(JSEnv* env, JSObject* object) {
+    if (object == NULL) return;
+    if (object->gc_mark) return;
+    object->gc_mark = 1;
+    if (env->gc_mark_stack_count >= env->gc_mark_stack_size) {
+        JSObject** stack = NULL;
+        unsigned int size = env->gc_mark_stack_size * 2;
+        if (size > JS_GC_STACK_LIMIT) size = JS_GC_STACK_LIMIT;
+        if (size > env->gc_mark_stack_size) {
+            stack = realloc(env->gc_mark_stack, sizeof(JSObject*) * size);
+        }
+        if (stack == NULL) {
+            env->gc_mark_overflow = 1;
+            return;
+        }
+        env->gc_mark_stack = stack;
+        env->gc_mark_stack_size = size;
+    }
+    env->gc_mark_stack[env->gc_mark_stack_count++] = object;
+    if (env->gc_mark_stack_count > env->gc_stats.mark_stack_depth) {
+        env->gc_stats.mark_stack_depth = env->gc_mark_stack_count;
+    }
+}
+
+static void gc_scan(JSEnv* env, JSObject* object) {
+    int i;
+    for (i = 0; i < object->properties_count; i++) {
+        JSValue value = object->properties[i].value;
+        if (value.type == TypeObject) {
+            gc_mark(env, value.as.object);
+        }
+    }
+    gc_mark(env, object->prototype);
+    if (object->class == ClassFunction) {
+        gc_mark(env, ((JSFunctionObject*) object)->binding);
+    }
+    if (JS_IS_BUFFER_OBJECT(object)) {
+        gc_mark(env, ((JSBufferObject*) object)->buffer);
+    }
+}
+
+static void gc_drain_mark_stack(JSEnv* env) {
+    while (env->gc_mark_stack_count > 0) {
+        gc_scan(env, env->gc_mark_stack[--env->gc_mark_stack_count]);
+    }
+}
+
+// Marks everything reachable from objects already on the mark stack.
+static void gc_mark_all(JSEnv* env) {
+    int i;
+    gc_drain_mark_stack(env);
+    while (env->gc_mark_overflow) {
+        env->gc_mark_overflow = 0;
+        env->gc_stats.mark_stack_overflows++;
+        for (i = 0; i < env->objects_count; i++) {
+            if (env->objects[i]->gc_mark) {
+                gc_scan(env, env->objects[i]);
+                gc_drain_mark_stack(env);
+            }
+        }
+    }
+}
+
+static JSObject* gc_run(JSEnv* env, va_list args) {
+    int i, j;
+    JSGCStats* stats = &env->gc_stats;
+    unsigned long long start = clock_ns();
+    size_t bytes = 0, property_bytes = 0;
+
+#ifdef JS_GC_VERBOSE
+    fprintf(stderr, "gc start: %d\n", env->objects_count);
+#endif
+
+    for (i = 0; i < env->objects_count; i++) {
+        env->objects[i]->gc_mark = 0;
+        bytes += gc_object_bytes(env->objects[i]);
+    }
+    stats->objects_before = env->objects_count;
+    stats->bytes_before = bytes;
+    stats->mark_stack_depth = 0;
+
+    JSObject* object = NULL;
+    do {
+        object = va_arg(args, JSObject*);
+        gc_mark(env, object);
+    } while (object != NULL);
+
+    for (i = 0; i < env->call_stack_count; i++) {
+        JSValue value = env->call_stack[i];
+        if (value.type == TypeObject) {
+            gc_mark(env, value.as.object);
+        }
+    }
+    for (i = 0; i < IntrinsicsCount; i++) {
+        gc_mark(env, env->intrinsics[i]);
+    }
+    if (env->tail_call && env->tail_callee.type == TypeObject) {
+        gc_mark(env, env->tail_callee.as.object);
+    }
+    if (env->tail_call && env->tail_this.type == TypeObject) {
+        gc_mark(env, env->tail_this.as.object);
+    }
+
+    gc_mark_all(env);
+
+    for (i = 0; i < env->objects_count; i++) {
+        if (env->objects[i]->gc_mark == 0) {
+#ifdef JS_ALLOC_PROFILE
+            alloc_profile_collected(env, env->objects[i], 0);
+#endif
+            object_destroy(env->objects[i]);
+            env->objects[i] = NULL;
+        }
+    }
+
+    j = 0;
+    bytes = 0;
+    env->buffer_bytes = 0;
+    for (i = 0; i < env->objects_count; i++) {
+        if (env->objects[i] != NULL) {
+            env->objects[j] = env->objects[i];
+            if (env->objects[j]->class == ClassArrayBuffer) {
+                env->buffer_bytes += ((JSBufferObject*) env->objects[j])->length;
+            }
+            bytes += gc_object_bytes(env->objects[j]);
+            property_bytes += gc_property_bytes(env->objects[j]);
+#ifdef JS_ALLOC_PROFILE
+            alloc_profile_collected(env, env->objects[j], 1);
+#endif
+            j++;
+        }
+    }
+    env->objects_count = j;
+    env->gc_last_objects_count = env->objects_count;
+    env->gc_last_buffer_bytes = env->buffer_bytes;
+
+    stats->cycles++;
+    stats->objects_after = env->objects_count;
+    stats->bytes_after = bytes;
+    stats->property_bytes_after = property_bytes;
+    if (stats->bytes_before > stats->max_bytes_before) {
+        stats->max_bytes_before = stats->bytes_before;
+    }
+    if (stats->mark_stack_depth > stats->max_mark_stack_depth) {
+        stats->max_mark_stack_depth = stats->mark_stack_depth;
+    }
+    stats->last_pause_ns = clock_ns() - start;
+    stats->total_pause_ns += stats->last_pause_ns;
+    if (stats->last_pause_ns > stats->max_pause_ns) {
+        stats->max_pause_ns = stats->last_pause_ns;
+    }
+
+#ifdef JS_GC_VERBOSE
+    fprintf(stderr, "gc end: %d (pause %.3f ms, %lu -> %lu bytes, mark stack %d, trigger %s)\n",
+        env->objects_count, stats->last_pause_ns / 1e6, (unsigned long) stats->bytes_before,
+        (unsigned long) stats->bytes_after, stats->mark_stack_depth, stats->trigger);
+#endif
+}
+
+// Collection starts when there are more than JS_GC_THRESHOLD objects and
+// their number doubled since the last collection, or the same holds for
+// bytes of ArrayBuffers and JS_GC_BUFFER_THRESHOLD.
+int js_gc_should_run(JSEnv* env) {
+    if (env->buffer_bytes > JS_GC_BUFFER_THRESHOLD && env->buffer_bytes > 2 * env->gc_last_buffer_bytes) {
+        env->gc_stats.trigger = "buffers";
+        env->gc_stats.trigger_limit = env->objects_count;
+        return 1;
+    }
+    if (env->objects_count > JS_GC_THRESHOLD && env->objects_count > 2 * env->gc_last_objects_count) {
+        if (2 * env->gc_last_objects_count > JS_GC_THRESHOLD) {
+            env->gc_stats.trigger = "heap doubled";
+            env->gc_stats.trigger_limit = 2 * env->gc_last_objects_count;
+        } else {
+            env->gc_stats.trigger = "threshold";
+            env->gc_stats.trigger_limit = JS_GC_THRESHOLD;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+void js_gc_run(JSEnv* env, ...) {
+    va_list args;
+    va_start(args, env);
+    gc_run(env, args);
+    va_end(args);
+}
+
+void js_gc_print_stats(JSEnv* env, FILE* out) {
+    JSGCStats* stats = &env->gc_stats;
+    fprintf(out, "gc cycles:          %u\n", stats->cycles);
+    fprintf(out, "gc threshold:       %u objects\n", (unsigned int) JS_GC_THRESHOLD);
+    fprintf(out, "gc pause total:     %.3f ms\n", stats->total_pause_ns / 1e6);
+    fprintf(out, "gc pause max:       %.3f ms\n", stats->max_pause_ns / 1e6);
+    if (stats->cycles > 0) {
+        fprintf(out, "gc pause mean:      %.3f ms\n", stats->total_pause_ns / 1e6 / stats->cycles);
+    }
+    fprintf(out, "heap peak:          %lu bytes\n", (unsigned long) stats->max_bytes_before);
+    fprintf(out, "mark stack max:     %u (limit %d, overflows %u)\n", stats->max_mark_stack_depth,
+        JS_GC_STACK_LIMIT, stats->mark_stack_overflows);
+    fprintf(out, "last cycle:         %u -> %u objects, %lu -> %lu bytes (%lu in properties), trigger %s at %u objects\n",
+        stats->objects_before, stats->objects_after,
+        (unsigned long) stats->bytes_before, (unsigned long) stats->bytes_after,
+        (unsigned long) stats->property_bytes_after, stats->trigger, stats->trigger_limit);
+    fprintf(out, "heap at exit:       %u objects\n", env->objects_count);
+}
+
+// --- profiler ---------------------------------------------------------------
+
+#ifdef JS_PROFILE
+// Calling context tree, each node is a function called from its parent.
+// It's used to write folded stacks for flame graphs.
+typedef struct TJSProfileNode {
+    unsigned int function;
+    unsigned long long exclusive;
+    struct TJSProfileNode* parent;
+    struct TJSProfileNode* children;
+    struct TJSProfileNode* next;
+} JSProfileNode;
+
+typedef struct {
+    unsigned long long calls;
+    unsigned long long inclusive;
+    unsigned long long exclusive;
+    // Number of active calls; inclusive time of recursive function is counted
+    // only when the outermost call finishes.
+    unsigned int active;
+} JSProfileCounters;
+
+typedef struct {
+    unsigned int function;
+    unsigned long long start;
+    unsigned long long children;
+    JSProfileNode* node;
+} JSProfileFrame;
+
+struct JSProfile {
+    JSFunctionInfo* info;
+    unsigned int info_count;
+    JSProfileCounters* counters;
+    JSProfileFrame* frames;
+    unsigned int frames_count;
+    unsigned int frames_size;
+    JSProfileNode root;
+    unsigned long long start;
+};
+
+// Environment which is reported at exit.
+static JSEnv* profiled_env = NULL;
+
+static JSProfileNode* profile_child_node(JSProfileNode* parent, unsigned int function) {
+    JSProfileNode* node = parent->children;
+    while (node != NULL) {
+        if (node->function == function) return node;
+        node = node->next;
+    }
+    node = calloc(1, sizeof(JSProfileNode));
+    node->function = function;
+    node->parent = parent;
+    node->next = parent->children;
+    parent->children = node;
+    return node;
+}
+
+void js_profile_enter(JSEnv* env, unsigned int function) {
+    struct JSProfile* profile = env->profile;
+    if (profile->frames_count >= profile->frames_size) {
+        profile->frames_size *= 2;
+        profile->frames = realloc(profile->frames, sizeof(JSProfileFrame) * profile->frames_size);
+    }
+    JSProfileNode* parent = &profile->root;
+    if (profile->frames_count > 0) {
+        parent = profile->frames[profile->frames_count - 1].node;
+    }
+    JSProfileFrame* frame = &profile->frames[profile->frames_count++];
+    frame->function = function;
+    frame->children = 0;
+    frame->node = profile_child_node(parent, function);
+    profile->counters[function].calls++;
+    profile->counters[function].active++;
+    frame->start = clock_ns();
+}
+
+void js_profile_exit(JSEnv* env) {
+    unsigned long long now = clock_ns();
+    struct JSProfile* profile = env->profile;
+    JSProfileFrame* frame = &profile->frames[--profile->frames_count];
+    JSProfileCounters* counters = &profile->counters[frame->function];
+    unsigned long long elapsed = now - frame->start;
+
+    counters->exclusive += elapsed - frame->children;
+    frame->node->exclusive += elapsed - frame->children;
+    counters->active--;
+    if (counters->active == 0) {
+        counters->inclusive += elapsed;
+    }
+    if (profile->frames_count > 0) {
+        profile->frames[profile->frames_count - 1].children += elapsed;
+    }
+}
+
+static struct JSProfile* profile_sort_target;
+
+static int profile_compare(const void* a, const void* b) {
+    unsigned long long x = profile_sort_target->counters[*(unsigned int*) a].exclusive;
+    unsigned long long y = profile_sort_target->counters[*(unsigned int*) b].exclusive;
+    return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+static void profile_write_report(struct JSProfile* profile, FILE* out) {
+    unsigned int i, count = 0;
+    unsigned int* order = malloc(sizeof(unsigned int) * profile->info_count);
+    unsigned long long total = clock_ns() - profile->start;
+
+    for (i = 0; i < profile->info_count; i++) {
+        if (profile->counters[i].calls > 0) order[count++] = i;
+    }
+    profile_sort_target = profile;
+    qsort(order, count, sizeof(unsigned int), profile_compare);
+
+    fprintf(out, "%12s %12s %12s %7s  %s\n", "calls", "incl ms", "excl ms", "excl %", "function");
+    for (i = 0; i < count; i++) {
+        JSProfileCounters* counters = &profile->counters[order[i]];
+        JSFunctionInfo* info = &profile->info[order[i]];
+        fprintf(out, "%12llu %12.3f %12.3f %6.2f%%  %s (%s:%d) %s\n",
+            counters->calls, counters->inclusive / 1e6, counters->exclusive / 1e6,
+            total > 0 ? 100.0 * counters->exclusive / total : 0.0,
+            info->name, info->file, info->line, info->c_name);
+    }
+    free(order);
+}
+
+// Folded stacks format: "outer;inner;innermost microseconds", one line per
+// calling context.
+static void profile_write_folded(struct JSProfile* profile, FILE* out, JSProfileNode* node,
+        JSProfileNode** path, unsigned int depth) {
+    unsigned int i;
+    JSProfileNode* child;
+
+    if (node != &profile->root) {
+        path[depth++] = node;
+        if (node->exclusive >= 1000) {
+            for (i = 0; i < depth; i++) {
+                JSFunctionInfo* info = &profile->info[path[i]->function];
+                fprintf(out, "%s%s (%s:%d)", i > 0 ? ";" : "", info->name, info->file, info->line);
+            }
+            fprintf(out, " %llu\n", node->exclusive / 1000);
+        }
+    }
+    for (child = node->children; child != NULL; child = child->next) {
+        profile_write_folded(profile, out, child, path, depth);
+    }
+}
+
+static unsigned int profile_tree_depth(JSProfileNode* node) {
+    unsigned int depth = 0, child_depth;
+    JSProfileNode* child;
+    for (child = node->children; child != NULL; child = child->next) {
+        child_depth = profile_tree_depth(child);
+        if (child_depth > depth) depth = child_depth;
+    }
+    return depth + 1;
+}
+
+// Writes report to stderr (or JS_PROFILE_OUT file) and folded stacks to
+// JS_PROFILE_FOLDED file, if given.
+static void profile_at_exit() {
+    JSEnv* env = profiled_env;
+    char* file_name;
+    FILE* out;
+
+    // functions that didn't return, e.g. when program calls exit()
+    profile_unwind(env, 0);
+
+    file_name = getenv("JS_PROFILE_OUT");
+    out = file_name ? fopen(file_name, "w") : stderr;
+    if (out != NULL) {
+        profile_write_report(env->profile, out);
+        if (out != stderr) fclose(out);
+    }
+
+    file_name = getenv("JS_PROFILE_FOLDED");
+    if (file_name && (out = fopen(file_name, "w")) != NULL) {
+        JSProfileNode** path = malloc(sizeof(JSProfileNode*) * profile_tree_depth(&env->profile->root));
+        profile_write_folded(env->profile, out, &env->profile->root, path, 0);
+        free(path);
+        fclose(out);
+    }
+}
+
+static unsigned int profile_depth(JSEnv* env) {
+    return env->profile->frames_count;
+}
+
+static void profile_unwind(JSEnv* env, unsigned int depth) {
+    while (env->profile->frames_count > depth) {
+        js_profile_exit(env);
+    }
+}
+
+void js_profile_setup(JSEnv* env, JSFunctionInfo* info, unsigned int info_count) {
+    struct JSProfile* profile = calloc(1, sizeof(struct JSProfile));
+    profile->info = info;
+    profile->info_count = info_count;
+    profile->counters = calloc(info_count, sizeof(JSProfileCounters));
+    profile->frames_size = 256;
+    profile->frames = malloc(sizeof(JSProfileFrame) * profile->frames_size);
+    profile->start = clock_ns();
+    env->profile = profile;
+
+    if (profiled_env == NULL) {
+        profiled_env = env;
+        atexit(profile_at_exit);
+    }
+}
+#endif
+
+// --- allocation profiler ----------------------------------------------------
+
+#ifdef JS_ALLOC_PROFILE
+typedef struct {
+    unsigned long long objects;
+    unsigned long long bytes;
+    unsigned long long strings;
+    unsigned long long string_bytes;
+    // Objects which went through a collection, survived it or not. Objects
+    // are counted only on their first collection.
+    unsigned long long survived;
+    unsigned long long died;
+    unsigned long long survived_bytes;
+} JSAllocCounters;
+
+struct JSAllocProfile {
+    JSAllocSiteInfo* sites;
+    unsigned int sites_count;
+    JSAllocCounters* counters;
+};
+
+// Environment which is reported at exit.
+static JSEnv* alloc_profiled_env = NULL;
+
+static void alloc_profile_object(JSEnv* env, JSObject* object) {
+    JSAllocCounters* counters = &env->alloc_profile->counters[env->alloc_site];
+    object->alloc_site = env->alloc_site;
+    object->alloc_collected = 0;
+    counters->objects++;
+    counters->bytes += gc_object_bytes(object);
+}
+
+static void alloc_profile_collected(JSEnv* env, JSObject* object, int survived) {
+    JSAllocCounters* counters = &env->alloc_profile->counters[object->alloc_site];
+    if (object->alloc_collected) return;
+    object->alloc_collected = 1;
+    if (survived) {
+        counters->survived++;
+        counters->survived_bytes += gc_object_bytes(object);
+    } else {
+        counters->died++;
+    }
+}
+
+static void alloc_profile_string(JSEnv* env, size_t bytes) {
+    JSAllocCounters* counters = &env->alloc_profile->counters[env->alloc_site];
+    counters->strings++;
+    counters->string_bytes += bytes;
+}
+
+// The functions below run the allocation at given site. The previous site is
+// restored afterwards, as allocations can be nested (e.g. constructor called
+// by js_invoke_constructor allocates its binding).
+
+JSValue js_construct_object_value_at(JSEnv* env, unsigned int site) {
+    unsigned int outer_site = env->alloc_site;
+    env->alloc_site = site;
+    JSValue result = js_construct_object_value(env);
+    env->alloc_site = outer_site;
+    return result;
+}
+
+JSValue js_new_object_literal_at(JSEnv* env, unsigned int site, JSObjectLayout* layout, int stack_count) {
+    unsigned int outer_site = env->alloc_site;
+    env->alloc_site = site;
+    JSValue result = js_new_object_literal(env, layout, stack_count);
+    env->alloc_site = outer_site;
+    return result;
+}
+
+JSValue js_construct_function_object_value_at(JSEnv* env, unsigned int site, JSValue (*function_ptr)(), JSObject* binding) {
+    unsigned int outer_site = env->alloc_site;
+    env->alloc_site = site;
+    JSValue result = js_construct_function_object_value(env, function_ptr, binding);
+    env->alloc_site = outer_site;
+    return result;
+}
+
+JSValue js_invoke_constructor_at(JSEnv* env, unsigned int site, JSValue constructor, int stack_count) {
+    unsigned int outer_site = env->alloc_site;
+    env->alloc_site = site;
+    JSValue result = js_invoke_constructor(env, constructor, stack_count);
+    env->alloc_site = outer_site;
+    return result;
+}
+
+JSValue js_add_at(JSEnv* env, unsigned int site, JSValue v1, JSValue v2) {
+    unsigned int outer_site = env->alloc_site;
+    // conversions may call toString() which allocates on its own
+    if (v1.type == TypeString || v2.type == TypeString) {
+        v1 = js_to_string(env, v1);
+        v2 = js_to_string(env, v2);
+    }
+    env->alloc_site = site;
+    JSValue result = js_add(env, v1, v2);
+    env->alloc_site = outer_site;
+    return result;
+}
+
+static struct JSAllocProfile* alloc_sort_target;
+
+static unsigned long long alloc_total_bytes(JSAllocCounters* counters) {
+    return counters->bytes + counters->string_bytes;
+}
+
+static int alloc_compare(const void* a, const void* b) {
+    unsigned long long x = alloc_total_bytes(&alloc_sort_target->counters[*(unsigned int*) a]);
+    unsigned long long y = alloc_total_bytes(&alloc_sort_target->counters[*(unsigned int*) b]);
+    return x < y ? 1 : (x > y ? -1 : 0);
+}
+
+// Writes sites which allocated most bytes to stderr (or JS_ALLOC_PROFILE_OUT
+// file). JS_ALLOC_PROFILE_TOP sets the number of sites, 20 by default.
+static void alloc_profile_at_exit() {
+    struct JSAllocProfile* profile = alloc_profiled_env->alloc_profile;
+    unsigned int i, count = 0, top = 20;
+    unsigned int* order = malloc(sizeof(unsigned int) * profile->sites_count);
+    char* file_name = getenv("JS_ALLOC_PROFILE_OUT");
+    FILE* out = file_name ? fopen(file_name, "w") : stderr;
+
+    if (out == NULL) return;
+    if (getenv("JS_ALLOC_PROFILE_TOP")) {
+        top = atoi(getenv("JS_ALLOC_PROFILE_TOP"));
+    }
+    for (i = 0; i < profile->sites_count; i++) {
+        if (alloc_total_bytes(&profile->counters[i]) > 0) order[count++] = i;
+    }
+    alloc_sort_target = profile;
+    qsort(order, count, sizeof(unsigned int), alloc_compare);
+
+    fprintf(out, "%12s %12s %10s %12s %9s  %s\n", "objects", "bytes", "strings", "string bytes", "survived", "site");
+    for (i = 0; i < count && i < top; i++) {
+        JSAllocCounters* counters = &profile->counters[order[i]];
+        JSAllocSiteInfo* site = &profile->sites[order[i]];
+        fprintf(out, "%12llu %12llu %10llu %12llu ", counters->objects, counters->bytes,
+            counters->strings, counters->string_bytes);
+        if (counters->survived + counters->died > 0) {
+            fprintf(out, "%8.1f%% ", 100.0 * counters->survived / (counters->survived + counters->died));
+        } else {
+            fprintf(out, "%9s ", "-");
+        }
+        fprintf(out, " %s in %s (%s:%d)\n", site->kind, site->function, site->file, site->line);
+    }
+    free(order);
+    if (out != stderr) fclose(out);
+}
+
+void js_alloc_profile_setup(JSEnv* env, JSAllocSiteInfo* sites, unsigned int sites_count) {
+    struct JSAllocProfile* profile = malloc(sizeof(struct JSAllocProfile));
+    profile->sites = sites;
+    profile->sites_count = sites_count;
+    profile->counters = calloc(sites_count, sizeof(JSAllocCounters));
+    env->alloc_profile = profile;
+    env->alloc_site = 0;
+
+    if (alloc_profiled_env == NULL) {
+        alloc_profiled_env = env;
+        atexit(alloc_profile_at_exit);
+    }
+}
+#endif
+
+// --- type feedback ----------------------------------------------------------
+
+#ifdef JS_FEEDBACK
+// Counts are capped when written, so that the compiler, which has 32-bit
+// numbers, can read and compare them.
+#define JS_FEEDBACK_MAX_COUNT 10000000ULL
+
+struct JSFeedback {
+    JSFeedbackSiteInfo* sites;
+    unsigned int sites_count;
+    // For operators, types seen on each side (bit 1 << type); for branches,
+    // times the condition was true and false.
+    unsigned long long (*counts)[2];
+};
+
+// Environment which is reported at exit.
+static JSEnv* feedback_env = NULL;
+
+JSValue js_feedback_operand(JSEnv* env, unsigned int site, int side, JSValue v) {
+    env->feedback->counts[site][side] |= 1 << v.type;
+    return v;
+}
+
+int js_feedback_branch(JSEnv* env, unsigned int site, int condition) {
+    env->feedback->counts[site][condition ? 0 : 1]++;
+    return condition;
+}
+
+// Writes the profile to JS_FEEDBACK_OUT file (feedback.txt by default): a
+// header followed by kind, both counts and location of every site, one per
+// line, in the order of the compiler's table.
+static void feedback_at_exit() {
+    struct JSFeedback* feedback = feedback_env->feedback;
+    char* file_name = getenv("JS_FEEDBACK_OUT");
+    FILE* out = fopen(file_name ? file_name : "feedback.txt", "w");
+    unsigned int i, side;
+
+    if (out == NULL) return;
+    fprintf(out, "tatende-feedback %u\n", feedback->sites_count);
+    for (i = 0; i < feedback->sites_count; i++) {
+        fprintf(out, "%s", feedback->sites[i].kind);
+        for (side = 0; side < 2; side++) {
+            unsigned long long count = feedback->counts[i][side];
+            fprintf(out, " %llu", count < JS_FEEDBACK_MAX_COUNT ? count : JS_FEEDBACK_MAX_COUNT);
+        }
+        fprintf(out, " %s:%d\n", feedback->sites[i].file, feedback->sites[i].line);
+    }
+    fclose(out);
+}
+
+void js_feedback_setup(JSEnv* env, JSFeedbackSiteInfo* sites, unsigned int sites_count) {
+    struct JSFeedback* feedback = malloc(sizeof(struct JSFeedback));
+    feedback->sites = sites;
+    feedback->sites_count = sites_count;
+    feedback->counts = calloc(sites_count, sizeof(feedback->counts[0]));
+    env->feedback = feedback;
+
+    if (feedback_env == NULL) {
+        feedback_env = env;
+        atexit(feedback_at_exit);
+    }
+}
+#endif
+
+// --- runtime counters -------------------------------------------------------
+
+#ifdef JS_STATS
+static double stats_average(unsigned long long total, unsigned long long count) {
+    return count > 0 ? (double) total / count : 0;
+}
+
+// Prints counters of the main thread to stderr.
+static void stats_at_exit() {
+    FILE* out = stderr;
+    fprintf(out, "%-36s %14s %10s\n", "counter", "total", "average");
+    fprintf(out, "%-36s %14llu\n", "property lookups", stats.property_lookups);
+    fprintf(out, "%-36s %14llu %10.2f\n", "own property searches, probes", stats.property_probes,
+        stats_average(stats.property_probes, stats.property_searches));
+    fprintf(out, "%-36s %14llu %10.2f\n", "prototype hops per lookup", stats.prototype_hops,
+        stats_average(stats.prototype_hops, stats.property_lookups));
+    fprintf(out, "%-36s %14llu\n", "prototype depth max", stats.prototype_depth_max);
+    fprintf(out, "%-36s %14llu\n", "string hashes", stats.hashes);
+    fprintf(out, "%-36s %14llu %10.2f\n", "bytes hashed", stats.hashed_bytes,
+        stats_average(stats.hashed_bytes, stats.hashes));
+    fprintf(out, "%-36s %14llu\n", "function calls", stats.function_calls);
+    fprintf(out, "%-36s %14llu\n", "method calls", stats.method_calls);
+    fprintf(out, "%-36s %14llu\n", "number to string conversions", stats.number_to_string);
+    fprintf(out, "%-36s %14llu\n", "string bytes concatenated", stats.concat_bytes);
+    fprintf(out, "%-36s %14llu\n", "try blocks (setjmp)", stats.try_blocks);
+    fprintf(out, "%-36s %14llu\n", "throws (longjmp)", stats.throws);
+    fprintf(out, "%-36s %14llu\n", "call stack peak", stats.call_stack_peak);
+}
+
+static void stats_set(JSEnv* env, JSValue result, char* key, unsigned long long value) {
+    js_set_property(env, result, js_string_value_from_cstring(key),
+        js_new_number(value < INT_MAX ? value : INT_MAX));
+}
+#endif
+
+// With -DJS_STATS the table of counters is printed at exit. Method calls
+// are also counted as function calls; the average of probes is per own
+// property search.
+void js_stats_setup(JSEnv* env) {
+#ifdef JS_STATS
+    static int registered = 0;
+    if (!registered) {
+        registered = 1;
+        atexit(stats_at_exit);
+    }
+#endif
+}
+
+// stats() returns the counters of the calling thread so far (capped at
+// 2^31 - 1), or undefined in builds without them.
+JSValue js_stats(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JS_CALL_STACK_POP;
+#ifdef JS_STATS
+    JSValue result = js_construct_object_value(env);
+    stats_set(env, result, "propertyLookups", stats.property_lookups);
+    stats_set(env, result, "propertySearches", stats.property_searches);
+    stats_set(env, result, "propertyProbes", stats.property_probes);
+    stats_set(env, result, "prototypeHops", stats.prototype_hops);
+    stats_set(env, result, "prototypeDepthMax", stats.prototype_depth_max);
+    stats_set(env, result, "hashes", stats.hashes);
+    stats_set(env, result, "hashedBytes", stats.hashed_bytes);
+    stats_set(env, result, "functionCalls", stats.function_calls);
+    stats_set(env, result, "methodCalls", stats.method_calls);
+    stats_set(env, result, "numberToString", stats.number_to_string);
+    stats_set(env, result, "concatBytes", stats.concat_bytes);
+    stats_set(env, result, "tryBlocks", stats.try_blocks);
+    stats_set(env, result, "throws", stats.throws);
+    stats_set(env, result, "callStackPeak", stats.call_stack_peak);
+    return result;
+#else
+    return js_new_undefined();
+#endif
+}
+
+// --- workers ----------------------------------------------------------------
+
+static JSString string_copy(JSString string) {
+    JSString copy;
+    copy.cstring = malloc(sizeof(char) * (string.length + 1));
+    memcpy(copy.cstring, string.cstring, string.length);
+    copy.cstring[string.length] = '\0';
+    copy.length = string.length;
+    return copy;
+}
+
+// Worker's environment gets globals workerModule, workerData and postMessage.
+// The program, seeing workerModule, requires the module instead of running
+// its input (see compiler.js).
+static void* worker_main(void* argument) {
+    JSWorker* worker = argument;
+    JSEnv* env = js_program_setup(0, NULL);
+    env->worker = worker;
+    js_set_property(env, env->global, js_string_value_from_cstring("workerModule"), js_string_value_from_string(worker->module));
+    js_set_property(env, env->global, js_string_value_from_cstring("workerData"), js_string_value_from_string(worker->data));
+    js_set_property(env, env->global, js_string_value_from_cstring("postMessage"), js_construct_function_object_value(env, &js_worker_post_message, NULL));
+    js_program_run(env);
+    js_env_destroy(env);
+
+    pthread_mutex_lock(&worker->lock);
+    worker->done = 1;
+    pthread_cond_broadcast(&worker->changed);
+    pthread_mutex_unlock(&worker->lock);
+    return NULL;
+}
+
+// Workers keep their position in env->workers as the primitive value.
+static JSWorker* worker_from_this(JSEnv* env, JSValue this) {
+    if (this.type != TypeObject || this.as.object == NULL || this.as.object->class != ClassWorker ||
+            this.as.object->primitive.as.number >= env->workers_count) {
+        JS_CALL_STACK_PUSH(js_string_value_from_cstring("Worker method called on an object which is not a worker"));
+        js_throw(env, js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1));
+    }
+    return env->workers[this.as.object->primitive.as.number];
+}
+
+// new Worker(module, data) starts the program on a new thread with a fresh
+// environment, running given module. data is passed as a string.
+JSValue js_worker_constructor(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JSValue module = js_new_undefined(), data = js_new_undefined();
+    if (stack_count > 0) {
+        module = JS_CALL_STACK_ITEM(0);
+    }
+    if (stack_count > 1) {
+        data = JS_CALL_STACK_ITEM(1);
+    }
+    JS_CALL_STACK_POP;
+    // workers run the compiled program, not the interpreted one
+    if (env->bytecode != NULL) {
+        js_throw(env, js_string_value_from_cstring("Workers are not supported by the bytecode interpreter"));
+    }
+    // this becomes the worker, so it must be a new plain object
+    if (this.type != TypeObject || this.as.object == NULL || this.as.object->class != ClassObject ||
+            this.as.object == env->global.as.object) {
+        JS_CALL_STACK_PUSH(js_string_value_from_cstring("Worker must be called with new"));
+        js_throw(env, js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1));
+    }
+
+    JSWorker* worker = calloc(1, sizeof(JSWorker));
+    worker->module = string_copy(js_to_string(env, module).as.string);
+    worker->data = string_copy(js_to_string(env, data).as.string);
+    pthread_mutex_init(&worker->lock, NULL);
+    pthread_cond_init(&worker->changed, NULL);
+    if (env->workers_count >= env->workers_size) {
+        env->workers_size = env->workers_size ? 2 * env->workers_size : 4;
+        env->workers = realloc(env->workers, sizeof(JSWorker*) * env->workers_size);
+    }
+    env->workers[env->workers_count] = worker;
+    this.as.object->class = ClassWorker;
+    this.as.object->primitive = js_new_number(env->workers_count);
+    env->workers_count++;
+
+    if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+        js_throw(env, js_string_value_from_cstring("Cannot start worker"));
+    }
+    return this;
+}
+
+// postMessage(string) called by a worker sends a copy of the string to its
+// parent.
+JSValue js_worker_post_message(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JSValue data = js_new_undefined();
+    if (stack_count > 0) {
+        data = JS_CALL_STACK_ITEM(0);
+    }
+    JS_CALL_STACK_POP;
+
+    JSMessage* message = malloc(sizeof(JSMessage));
+    message->data = string_copy(js_to_string(env, data).as.string);
+    message->next = NULL;
+    JSWorker* worker = env->worker;
+    pthread_mutex_lock(&worker->lock);
+    if (worker->last_message) {
+        worker->last_message->next = message;
+    } else {
+        worker->first_message = message;
+    }
+    worker->last_message = message;
+    pthread_cond_broadcast(&worker->changed);
+    pthread_mutex_unlock(&worker->lock);
+    return js_new_undefined();
+}
+
+// worker.receive() waits for the next message. Returns undefined when the
+// worker has finished and all its messages were received.
+JSValue js_worker_receive(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JS_CALL_STACK_POP;
+    JSWorker* worker = worker_from_this(env, this);
+    pthread_mutex_lock(&worker->lock);
+    while (worker->first_message == NULL && !worker->done) {
+        pthread_cond_wait(&worker->changed, &worker->lock);
+    }
+    JSMessage* message = worker->first_message;
+    if (message) {
+        worker->first_message = message->next;
+        if (worker->first_message == NULL) {
+            worker->last_message = NULL;
+        }
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    if (message == NULL) {
+        return js_new_undefined();
+    }
+    JSValue result = js_string_value_from_string(message->data);
+    free(message);
+    return result;
+}
+
+// worker.join() waits until the worker finishes.
+JSValue js_worker_join(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JS_CALL_STACK_POP;
+    JSWorker* worker = worker_from_this(env, this);
+    if (!worker->joined) {
+        pthread_join(worker->thread, NULL);
+        worker->joined = 1;
+    }
+    return js_new_undefined();
+}
+
+// --- bytecode interpreter ---------------------------------------------------
+
+// Programs compiled by bytecode_backend.js run in an environment of their own
+// (see js_run_bytecode), made of the same objects, natives and collector as
+// compiled programs. Function objects point to bytecode functions instead of
+// C ones. Operands of expressions are kept on the call stack, which the
+// collector scans, so they stay reachable; it may be reallocated by any call,
+// so it's accessed by index.
+
+// Must match the order of opcodeNames in bytecode_backend.js.
+enum {
+    OpUndefined, OpNull, OpTrue, OpFalse, OpNumber, OpString, OpThis,
+    OpGetLocal, OpSetLocal, OpGetGlobal, OpSetGlobal,
+    OpGetProperty, OpSetProperty, OpEmptyObject, OpObject, OpFunction,
+    OpCall, OpCallMethod, OpNew, OpTailCall, OpTailCallMethod,
+    OpAdd, OpSub, OpMul, OpLt, OpGt, OpEq, OpNeq, OpStrictEq, OpStrictNeq,
+    OpBitAnd, OpBitXor, OpBitOr, OpAnd, OpOr, OpInstanceof,
+    OpTypeof, OpNot, OpToNumber, OpNegate,
+    OpPop, OpDup, OpJump, OpJumpIfFalse, OpJumpIfTrue,
+    OpForInBegin, OpForInNext, OpForInEnd, OpTry, OpThrow, OpReturn, OpEnd
+};
+
+static int bytecode_read_int(char** cursor) {
+    return (int) strtol(*cursor, cursor, 10);
+}
+
+static JSString bytecode_read_string(char** cursor, JSBytecodeProgram* program) {
+    return program->strings[bytecode_read_int(cursor)];
+}
+
+// Strings are unescaped in place, in a copy of the text.
+static JSBytecodeProgram* bytecode_load(JSString text) {
+    JSBytecodeProgram* program = calloc(1, sizeof(JSBytecodeProgram));
+    unsigned int i, j, count;
+    char* cursor;
+
+    program->text = string_copy(text).cstring;
+    cursor = program->text;
+    if (strncmp(cursor, "tatende-bytecode 1\n", 19) != 0) {
+        free(program->text);
+        free(program);
+        return NULL;
+    }
+    cursor += 19;
+    program->strings_count = bytecode_read_int(&cursor);
+    cursor++;
+    program->strings = malloc(sizeof(JSString) * program->strings_count);
+    for (i = 0; i < program->strings_count; i++) {
+        char* out = cursor;
+        program->strings[i].cstring = out;
+        while (*cursor != '\n' && *cursor != '\0') {
+            if (*cursor == '\\' && cursor[1] != '\0') {
+                *out++ = cursor[1] == 'n' ? '\n' : cursor[1];
+                cursor += 2;
+            } else {
+                *out++ = *cursor++;
+            }
+        }
+        if (*cursor == '\n') {
+            cursor++;
+        }
+        *out = '\0';
+        program->strings[i].length = out - program->strings[i].cstring;
+    }
+
+    count = bytecode_read_int(&cursor);
+    program->global_names = malloc(sizeof(char*) * (count + 1));
+    for (i = 0; i < count; i++) {
+        program->global_names[i] = bytecode_read_string(&cursor, program).cstring;
+    }
+    program->global_names[count] = NULL;
+
+    program->layouts_count = bytecode_read_int(&cursor);
+    program->layouts = calloc(program->layouts_count, sizeof(JSObjectLayout));
+    for (i = 0; i < program->layouts_count; i++) {
+        JSObjectLayout* layout = &program->layouts[i];
+        layout->count = bytecode_read_int(&cursor);
+        layout->keys = malloc(sizeof(char*) * layout->count);
+        for (j = 0; j < layout->count; j++) {
+            layout->keys[j] = bytecode_read_string(&cursor, program).cstring;
+        }
+    }
+
+    program->functions_count = bytecode_read_int(&cursor);
+    program->functions = malloc(sizeof(JSBytecodeFunction) * program->functions_count);
+    for (i = 0; i < program->functions_count; i++) {
+        JSBytecodeFunction* function = &program->functions[i];
+        function->args_count = bytecode_read_int(&cursor);
+        function->args = malloc(sizeof(JSString) * function->args_count);
+        for (j = 0; j < function->args_count; j++) {
+            function->args[j] = bytecode_read_string(&cursor, program);
+        }
+        function->locals_count = bytecode_read_int(&cursor);
+        function->locals = malloc(sizeof(JSString) * function->locals_count);
+        for (j = 0; j < function->locals_count; j++) {
+            function->locals[j] = bytecode_read_string(&cursor, program);
+        }
+        function->uses_arguments = bytecode_read_int(&cursor);
+        function->for_in_slots = bytecode_read_int(&cursor);
+        count = bytecode_read_int(&cursor);
+        function->code = malloc(sizeof(int) * count);
+        for (j = 0; j < count; j++) {
+            function->code[j] = bytecode_read_int(&cursor);
+        }
+    }
+    program->prelude = bytecode_read_int(&cursor);
+    program->program = bytecode_read_int(&cursor);
+    return program;
+}
+
+static void bytecode_free(JSBytecodeProgram* program) {
+    unsigned int i;
+    for (i = 0; i < program->functions_count; i++) {
+        free(program->functions[i].args);
+        free(program->functions[i].locals);
+        free(program->functions[i].code);
+    }
+    for (i = 0; i < program->layouts_count; i++) {
+        free(program->layouts[i].keys);
+        free(program->layouts[i].positions);
+        free(program->layouts[i].properties);
+    }
+    free(program->functions);
+    free(program->layouts);
+    free(program->global_names);
+    free(program->strings);
+    free(program->text);
+    free(program);
+}
+
+static JSValue bytecode_function_value(JSEnv* env, unsigned int index, JSObject* binding) {
+    JSFunctionObject* function_object = js_construct_function_object(env, NULL, binding);
+    function_object->bytecode = &env->bytecode->functions[index];
+    return js_object_value_from_object((JSObject*) function_object);
+}
+
+static JSValue interpret(JSEnv* env, JSBytecodeFunction* function, int pc,
+        JSValue this, JSObject* binding, int* returned);
+
+// Runs blocks of a try statement, like code generated by c_backend.js does.
+// Returns whether one of them returned, with the value in ret.
+static int interpret_try(JSEnv* env, JSBytecodeFunction* function, int try_pc, int catch_pc, int finally_pc,
+        JSString name, JSValue this, JSObject* binding, JSValue* ret) {
+    JSException* exc = js_push_new_exception(env);
+    JSValue inner_ret;
+    int returned, finally_returned;
+    if (!setjmp(exc->jmp)) {
+        inner_ret = interpret(env, function, try_pc, this, binding, &returned);
+        js_pop_exception(env);
+    } else {
+        JSObject* catch_binding = object_new(binding);
+        object_add_property(catch_binding, name, exc->value);
+        js_pop_exception(env);
+        inner_ret = interpret(env, function, catch_pc, this, catch_binding, &returned);
+    }
+    interpret(env, function, finally_pc, this, binding, &finally_returned);
+    if (returned) {
+        *ret = inner_ret;
+    }
+    return returned;
+}
+
+#define TOP(i) (env->call_stack[env->call_stack_count - 1 - (i)])
+#define PUSH(v) js_call_stack_push(env, (v))
+#define DISPATCH() goto *labels[code[pc++]]
+#define UNARY(expr) { JSValue result = (expr); TOP(0) = result; DISPATCH(); }
+#define BINARY(f) { JSValue result = f(env, TOP(1), TOP(0)); env->call_stack_count--; TOP(0) = result; DISPATCH(); }
+
+// Runs code of the function from pc until RETURN, which sets *returned, or
+// END, which ends blocks of try statements. Instructions are dispatched
+// with computed gotos.
+static JSValue interpret(JSEnv* env, JSBytecodeFunction* function, int pc,
+        JSValue this, JSObject* binding, int* returned) {
+    static void* labels[] = {
+        [OpUndefined] = &&op_undefined, [OpNull] = &&op_null, [OpTrue] = &&op_true,
+        [OpFalse] = &&op_false, [OpNumber] = &&op_number, [OpString] = &&op_string,
+        [OpThis] = &&op_this, [OpGetLocal] = &&op_get_local, [OpSetLocal] = &&op_set_local,
+        [OpGetGlobal] = &&op_get_global, [OpSetGlobal] = &&op_set_global,
+        [OpGetProperty] = &&op_get_property, [OpSetProperty] = &&op_set_property,
+        [OpEmptyObject] = &&op_empty_object, [OpObject] = &&op_object, [OpFunction] = &&op_function,
+        [OpCall] = &&op_call, [OpCallMethod] = &&op_call_method, [OpNew] = &&op_new,
+        [OpTailCall] = &&op_tail_call, [OpTailCallMethod] = &&op_tail_call_method,
+        [OpAdd] = &&op_add, [OpSub] = &&op_sub, [OpMul] = &&op_mul, [OpLt] = &&op_lt,
+        [OpGt] = &&op_gt, [OpEq] = &&op_eq, [OpNeq] = &&op_neq, [OpStrictEq] = &&op_strict_eq,
+        [OpStrictNeq] = &&op_strict_neq, [OpBitAnd] = &&op_bit_and, [OpBitXor] = &&op_bit_xor,
+        [OpBitOr] = &&op_bit_or, [OpAnd] = &&op_and, [OpOr] = &&op_or,
+        [OpInstanceof] = &&op_instanceof, [OpTypeof] = &&op_typeof, [OpNot] = &&op_not,
+        [OpToNumber] = &&op_to_number, [OpNegate] = &&op_negate, [OpPop] = &&op_pop,
+        [OpDup] = &&op_dup, [OpJump] = &&op_jump, [OpJumpIfFalse] = &&op_jump_if_false,
+        [OpJumpIfTrue] = &&op_jump_if_true, [OpForInBegin] = &&op_for_in_begin,
+        [OpForInNext] = &&op_for_in_next, [OpForInEnd] = &&op_for_in_end, [OpTry] = &&op_try,
+        [OpThrow] = &&op_throw, [OpReturn] = &&op_return, [OpEnd] = &&op_end
+    };
+    JSBytecodeProgram* program = env->bytecode;
+    int* code = function->code;
+    // keys of for-in loops and positions in them, released when leaving
+    JSForInKeys* for_in[function->for_in_slots + 1];
+    unsigned int for_in_i[function->for_in_slots + 1];
+    JSValue ret = js_new_undefined();
+    unsigned int i, base, frame_end;
+
+    for (i = 0; i < function->for_in_slots; i++) {
+        for_in[i] = NULL;
+    }
+    // binding and this stay on the stack, below operands
+    PUSH(js_object_value_from_object(binding));
+    PUSH(this);
+    base = env->call_stack_count;
+    frame_end = base - 2;
+    DISPATCH();
+
+op_undefined:
+    PUSH(js_new_undefined());
+    DISPATCH();
+op_null:
+    PUSH(js_new_null());
+    DISPATCH();
+op_true:
+    PUSH(js_new_boolean(1));
+    DISPATCH();
+op_false:
+    PUSH(js_new_boolean(0));
+    DISPATCH();
+op_number:
+    PUSH(js_new_number(code[pc++]));
+    DISPATCH();
+op_string:
+    PUSH(js_string_value_from_string(program->strings[code[pc++]]));
+    DISPATCH();
+op_this:
+    PUSH(this);
+    DISPATCH();
+op_get_local:
+    PUSH(js_get_variable_rvalue(env, binding, program->strings[code[pc++]]));
+    DISPATCH();
+op_set_local:
+    js_assign_variable(env, binding, program->strings[code[pc++]], TOP(0));
+    DISPATCH();
+op_get_global: {
+    unsigned int n = code[pc++];
+    PUSH(JS_GLOBAL_CELL(n));
+    DISPATCH();
+}
+op_set_global:
+    js_set_global_cell(env, code[pc++], TOP(0));
+    DISPATCH();
+op_get_property:
+    BINARY(js_get_property);
+op_set_property: {
+    JSValue result = js_set_property(env, TOP(2), TOP(1), TOP(0));
+    env->call_stack_count -= 2;
+    TOP(0) = result;
+    DISPATCH();
+}
+op_empty_object:
+    PUSH(js_construct_object_value(env));
+    DISPATCH();
+op_object: {
+    JSObjectLayout* layout = &program->layouts[code[pc++]];
+    int count = code[pc++];
+    PUSH(js_new_object_literal(env, layout, count));
+    DISPATCH();
+}
+op_function:
+    PUSH(bytecode_function_value(env, code[pc++], binding));
+    DISPATCH();
+op_call: {
+    // the callee stays below its arguments, which the call pops
+    int count = code[pc++];
+    UNARY(js_call_function(env, TOP(count), env->global, count));
+}
+op_call_method: {
+    int count = code[pc++];
+    JSValue result = js_call_method(env, TOP(count + 1), TOP(count), count);
+    env->call_stack_count--;
+    TOP(0) = result;
+    DISPATCH();
+}
+op_new: {
+    int count = code[pc++];
+    UNARY(js_invoke_constructor(env, TOP(count), count));
+}
+op_tail_call: {
+    int count = code[pc++];
+    js_tail_call(env, TOP(count), env->global, count);
+    goto tail_call;
+}
+op_tail_call_method: {
+    int count = code[pc++];
+    js_tail_call_method(env, TOP(count + 1), TOP(count), count);
+    goto tail_call;
+}
+op_add:
+    BINARY(js_add);
+op_sub:
+    BINARY(js_sub);
+op_mul:
+    BINARY(js_mult);
+op_lt:
+    BINARY(js_lt);
+op_gt:
+    BINARY(js_gt);
+op_eq:
+    BINARY(js_eq);
+op_neq:
+    BINARY(js_neq);
+op_strict_eq:
+    BINARY(js_strict_eq);
+op_strict_neq:
+    BINARY(js_strict_neq);
+op_bit_and:
+    BINARY(js_binary_and);
+op_bit_xor:
+    BINARY(js_binary_xor);
+op_bit_or:
+    BINARY(js_binary_or);
+op_and:
+    BINARY(js_logical_and);
+op_or:
+    BINARY(js_logical_or);
+op_instanceof:
+    BINARY(js_instanceof);
+op_typeof:
+    UNARY(js_typeof(TOP(0)));
+op_not:
+    UNARY(js_new_boolean(! js_to_boolean(TOP(0)).as.boolean));
+op_to_number:
+    UNARY(js_new_number(js_to_number(env, TOP(0)).as.number));
+op_negate:
+    UNARY(js_new_number(-1 * js_to_number(env, TOP(0)).as.number));
+op_pop:
+    env->call_stack_count--;
+    DISPATCH();
+op_dup: {
+    JSValue value = TOP(0);
+    PUSH(value);
+    DISPATCH();
+}
+op_jump:
+    pc = code[pc];
+    DISPATCH();
+op_jump_if_false: {
+    int target = code[pc++];
+    int truthy = js_is_truthy(TOP(0));
+    env->call_stack_count--;
+    if (!truthy) {
+        pc = target;
+    }
+    DISPATCH();
+}
+op_jump_if_true: {
+    int target = code[pc++];
+    int truthy = js_is_truthy(TOP(0));
+    env->call_stack_count--;
+    if (truthy) {
+        pc = target;
+    }
+    DISPATCH();
+}
+op_for_in_begin: {
+    int slot = code[pc++];
+    for_in[slot] = js_for_in_begin(env, TOP(0));
+    for_in_i[slot] = 0;
+    env->call_stack_count--;
+    DISPATCH();
+}
+op_for_in_next: {
+    int slot = code[pc++];
+    int exit = code[pc++];
+    if (for_in[slot] && for_in_i[slot] < for_in[slot]->count) {
+        PUSH(js_string_value_from_string(for_in[slot]->keys[for_in_i[slot]++]));
+    } else {
+        pc = exit;
+    }
+    DISPATCH();
+}
+op_for_in_end: {
+    int slot = code[pc++];
+    js_for_in_end(env, for_in[slot]);
+    for_in[slot] = NULL;
+    DISPATCH();
+}
+op_try: {
+    int catch_pc = code[pc++];
+    int finally_pc = code[pc++];
+    JSString name = program->strings[code[pc++]];
+    int after = code[pc++];
+    if (interpret_try(env, function, pc, catch_pc, finally_pc, name, this, binding, &ret)) {
+        *returned = 1;
+        goto done;
+    }
+    pc = after;
+    DISPATCH();
+}
+op_throw:
+    js_throw(env, TOP(0));
+op_return:
+    ret = TOP(0);
+    *returned = 1;
+    goto done;
+op_end:
+    *returned = 0;
+    goto done;
+
+tail_call:
+    // arguments of the pending call (see js_tail_call) replace the frame
+    memmove(&env->call_stack[frame_end], &env->call_stack[env->call_stack_count - env->tail_count],
+        sizeof(JSValue) * env->tail_count);
+    frame_end += env->tail_count;
+    *returned = 1;
+
+done:
+    for (i = 0; i < function->for_in_slots; i++) {
+        js_for_in_end(env, for_in[i]);
+    }
+    env->call_stack_count = frame_end;
+    return ret;
+}
+
+#undef TOP
+#undef PUSH
+#undef DISPATCH
+#undef UNARY
+#undef BINARY
+
+// Called instead of a C function for functions with bytecode. Prologue and
+// epilogue are the same as in functions generated by c_backend.js.
+static JSValue bytecode_call(JSEnv* env, JSBytecodeFunction* function, JSValue this, int stack_count,
+        JSObject* parent_binding) {
+    JSObject* binding = object_new(parent_binding);
+    int i, returned;
+    js_gc_save_object(env, binding);
+    if (function->uses_arguments) {
+        object_add_property(binding, string_from_cstring("arguments"),
+            js_invoke_constructor(env, intrinsic_value(env, IntrinsicArray), stack_count));
+        env->call_stack_count += stack_count;
+    }
+    for (i = 0; i < function->args_count; i++) {
+        if (stack_count > i) {
+            object_add_property(binding, function->args[i], JS_CALL_STACK_ITEM(i));
+        } else {
+            object_add_property(binding, function->args[i], js_new_undefined());
+        }
+    }
+    JS_CALL_STACK_POP;
+    for (i = 0; i < function->locals_count; i++) {
+        object_add_property(binding, function->locals[i], js_new_undefined());
+    }
+
+    JSValue ret = interpret(env, function, 0, this, binding, &returned);
+
+    if (js_gc_should_run(env)) {
+        if (this.type == TypeObject && ret.type == TypeObject) {
+            js_gc_run(env, env->global.as.object, parent_binding, this.as.object, ret.as.object, NULL);
+        } else if (this.type == TypeObject) {
+            js_gc_run(env, env->global.as.object, parent_binding, this.as.object, NULL);
+        } else if (ret.type == TypeObject) {
+            js_gc_run(env, env->global.as.object, parent_binding, ret.as.object, NULL);
+        } else {
+            js_gc_run(env, env->global.as.object, parent_binding, NULL);
+        }
+    }
+    return ret;
+}
+
+// runBytecode(text, args) runs a program compiled by bytecode_backend.js in a
+// new environment, with args as its argv, and returns when it ends. The
+// environment is set up like js_program_setup generated by c_backend.js does,
+// but the prelude comes with the program.
+JSValue js_run_bytecode(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JSValue text = js_new_undefined(), args = js_new_undefined();
+    int argc = 0, i;
+    char** argv;
+    if (stack_count > 0) {
+        text = JS_CALL_STACK_ITEM(0);
+    }
+    if (stack_count > 1) {
+        args = JS_CALL_STACK_ITEM(1);
+    }
+    JS_CALL_STACK_POP;
+
+#if defined(JS_PROFILE) || defined(JS_ALLOC_PROFILE)
+    js_throw(env, js_string_value_from_cstring("runBytecode is not supported by profiling builds"));
+#endif
+    JSBytecodeProgram* program = bytecode_load(js_to_string(env, text).as.string);
+    if (program == NULL) {
+        js_throw(env, js_string_value_from_cstring("Invalid bytecode"));
+    }
+    if (args.type == TypeObject && args.as.object != NULL) {
+        argc = js_to_number(env, js_get_property(env, args, js_string_value_from_cstring("length"))).as.number;
+    }
+    argv = malloc(sizeof(char*) * (argc + 1));
+    for (i = 0; i < argc; i++) {
+        argv[i] = string_copy(js_to_string(env, js_get_property(env, args, js_new_number(i))).as.string).cstring;
+    }
+
+    JSEnv* program_env = calloc(1, sizeof(JSEnv));
+    js_call_stack_setup(program_env);
+    js_gc_setup(program_env);
+    js_global_cells_setup(program_env, program->global_names);
+    program_env->bytecode = program;
+    program_env->global = js_object_value_from_object(object_new(NULL));
+    js_gc_save_object(program_env, program_env->global.as.object);
+    js_create_native_objects(program_env);
+    js_call_function(program_env, bytecode_function_value(program_env, program->prelude, NULL),
+        program_env->global, 0);
+    js_resolve_intrinsics(program_env);
+    js_create_argv(program_env, argc, argv);
+    js_call_function(program_env, bytecode_function_value(program_env, program->program, NULL),
+        program_env->global, 0);
+    js_env_destroy(program_env);
+
+    bytecode_free(program);
+    for (i = 0; i < argc; i++) {
+        free(argv[i]);
+    }
+    free(argv);
+    return js_new_undefined();
+}
+
+// --- JSON -------------------------------------------------------------------
+
+// Nesting deeper than that is rejected, so that recursion can't overflow the
+// C stack.
+#define JS_JSON_MAX_DEPTH 4096
+
+// Numbers of the runtime are 32-bit integers, so numbers with fractions or
+// exponents are truncated and large ones are clamped.
+typedef struct {
+    JSEnv* env;
+    const char* text;
+    unsigned int length;
+    unsigned int position;
+    unsigned int depth;
+    // Elements of arrays and members of objects which are being parsed,
+    // innermost last.
+    JSValue* values;
+    JSString* keys;
+    unsigned int values_count;
+    unsigned int keys_count;
+    unsigned int values_size;
+    unsigned int keys_size;
+    JSObject* array_prototype;
+} JSJsonParser;
+
+static void json_parse_fail(JSJsonParser* parser) {
+    JSEnv* env = parser->env;
+    char* message = malloc(sizeof(char) * 64);
+    if (parser->position >= parser->length) {
+        strcpy(message, "Unexpected end of JSON input");
+    } else {
+        unsigned char c = parser->text[parser->position];
+        if (c >= 0x20 && c < 0x7f) {
+            sprintf(message, "Unexpected token %c in JSON at position %u", c, parser->position);
+        } else {
+            sprintf(message, "Unexpected character in JSON at position %u", parser->position);
+        }
+    }
+    free(parser->values);
+    free(parser->keys);
+    JS_CALL_STACK_PUSH(js_string_value_from_cstring(message));
+    js_throw(env, js_invoke_constructor(env, intrinsic_value(env, IntrinsicSyntaxError), 1));
+}
+
+static void json_skip_whitespace(JSJsonParser* parser) {
+    while (parser->position < parser->length) {
+        char c = parser->text[parser->position];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+        parser->position++;
+    }
+}
+
+static void json_expect(JSJsonParser* parser, const char* word) {
+    unsigned int length = strlen(word);
+    if (parser->length - parser->position < length ||
+            memcmp(parser->text + parser->position, word, length) != 0) {
+        json_parse_fail(parser);
+    }
+    parser->position += length;
+}
+
+static int json_is_digit(JSJsonParser* parser) {
+    return parser->position < parser->length &&
+        parser->text[parser->position] >= '0' && parser->text[parser->position] <= '9';
+}
+
+static JSValue json_parse_number(JSJsonParser* parser) {
+    unsigned int start = parser->position;
+    int integer = 1;
+    long long value = 0;
+    if (parser->text[parser->position] == '-') parser->position++;
+    if (!json_is_digit(parser)) json_parse_fail(parser);
+    if (parser->text[parser->position] == '0') {
+        parser->position++;
+    } else {
+        while (json_is_digit(parser)) {
+            if (value <= INT_MAX) value = value * 10 + (parser->text[parser->position] - '0');
+            parser->position++;
+        }
+    }
+    if (parser->position < parser->length && parser->text[parser->position] == '.') {
+        integer = 0;
+        parser->position++;
+        if (!json_is_digit(parser)) json_parse_fail(parser);
+        while (json_is_digit(parser)) parser->position++;
+    }
+    if (parser->position < parser->length &&
+            (parser->text[parser->position] == 'e' || parser->text[parser->position] == 'E')) {
+        integer = 0;
+        parser->position++;
+        if (parser->position < parser->length &&
+                (parser->text[parser->position] == '+' || parser->text[parser->position] == '-')) {
+            parser->position++;
+        }
+        if (!json_is_digit(parser)) json_parse_fail(parser);
+        while (json_is_digit(parser)) parser->position++;
+    }
+    if (integer) {
+        if (parser->text[start] == '-') value = -value;
+    } else {
+        unsigned int length = parser->position - start;
+        char* copy = malloc(sizeof(char) * (length + 1));
+        double number;
+        memcpy(copy, parser->text + start, length);
+        copy[length] = '\0';
+        number = strtod(copy, NULL);
+        free(copy);
+        value = number > INT_MAX ? INT_MAX : (number < INT_MIN ? INT_MIN : (long long) number);
+    }
+    if (value > INT_MAX) value = INT_MAX;
+    if (value < INT_MIN) value = INT_MIN;
+    return js_new_number(value);
+}
+
+// Position of the first quote, backslash or control character from the given
+// one, or length if there is none. Builds with SSE2 (see string_find) check
+// 16 bytes at a time.
+static unsigned int json_scan_string(const char* text, unsigned int position, unsigned int length) {
+#ifdef __SSE2__
+    __m128i quote = _mm_set1_epi8('"');
+    __m128i backslash = _mm_set1_epi8('\\');
+    __m128i space = _mm_set1_epi8(0x20);
+    while (position + 16 <= length) {
+        __m128i block = _mm_loadu_si128((__m128i*) (text + position));
+        // bytes not below space are equal to their maximum with it
+        unsigned int mask = _mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash)));
+        mask |= ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(block, space), block)) & 0xffff;
+        if (mask != 0) {
+            return position + __builtin_ctz(mask);
+        }
+        position += 16;
+    }
+#endif
+    while (position < length) {
+        unsigned char c = text[position];
+        if (c == '"' || c == '\\' || c < 0x20) break;
+        position++;
+    }
+    return position;
+}
+
+static int json_hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Reads four hex digits of \u escape, whose "u" is at the current position.
+static unsigned int json_parse_code_unit(JSJsonParser* parser) {
+    unsigned int i, unit = 0;
+    parser->position++;
+    for (i = 0; i < 4; i++) {
+        int digit = -1;
+        if (parser->position < parser->length) {
+            digit = json_hex_digit(parser->text[parser->position]);
+        }
+        if (digit < 0) json_parse_fail(parser);
+        unit = unit * 16 + digit;
+        parser->position++;
+    }
+    return unit;
+}
+
+static char* json_write_utf8(char* out, unsigned int code_point) {
+    if (code_point < 0x80) {
+        *out++ = code_point;
+    } else if (code_point < 0x800) {
+        *out++ = 0xc0 | (code_point >> 6);
+        *out++ = 0x80 | (code_point & 0x3f);
+    } else if (code_point < 0x10000) {
+        *out++ = 0xe0 | (code_point >> 12);
+        *out++ = 0x80 | ((code_point >> 6) & 0x3f);
+        *out++ = 0x80 | (code_point & 0x3f);
+    } else {
+        *out++ = 0xf0 | (code_point >> 18);
+        *out++ = 0x80 | ((code_point >> 12) & 0x3f);
+        *out++ = 0x80 | ((code_point >> 6) & 0x3f);
+        *out++ = 0x80 | (code_point & 0x3f);
+    }
+    return out;
+}
+
+// Strings without escapes share memory with the parsed text. Others are
+// decoded to a new buffer, which is never longer than the source.
+static JSString json_parse_string(JSJsonParser* parser) {
+    unsigned int start = ++parser->position;
+    JSString string;
+    char* out;
+
+    parser->position = json_scan_string(parser->text, parser->position, parser->length);
+    if (parser->position < parser->length && parser->text[parser->position] == '"') {
+        string.cstring = (char*) parser->text + start;
+        string.length = parser->position - start;
+        parser->position++;
+        return string;
+    }
+
+    string.cstring = malloc(sizeof(char) * (parser->length - start + 1));
+    out = string.cstring;
+    memcpy(out, parser->text + start, parser->position - start);
+    out += parser->position - start;
+    while (1) {
+        unsigned int run = parser->position;
+        parser->position = json_scan_string(parser->text, parser->position, parser->length);
+        memcpy(out, parser->text + run, parser->position - run);
+        out += parser->position - run;
+        if (parser->position >= parser->length || (unsigned char) parser->text[parser->position] < 0x20) {
+            free(string.cstring);
+            json_parse_fail(parser);
+        }
+        if (parser->text[parser->position] == '"') break;
+
+        parser->position++;
+        if (parser->position >= parser->length) {
+            free(string.cstring);
+            json_parse_fail(parser);
+        }
+        switch (parser->text[parser->position]) {
+            case '"': *out++ = '"'; break;
+            case '\\': *out++ = '\\'; break;
+            case '/': *out++ = '/'; break;
+            case 'b': *out++ = '\b'; break;
+            case 'f': *out++ = '\f'; break;
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'u': {
+                unsigned int unit = json_parse_code_unit(parser);
+                // a surrogate pair stands for one code point
+                if (unit >= 0xd800 && unit < 0xdc00 && parser->length - parser->position >= 6 &&
+                        parser->text[parser->position] == '\\' && parser->text[parser->position + 1] == 'u') {
+                    unsigned int position = parser->position;
+                    unsigned int low;
+                    parser->position++;
+                    low = json_parse_code_unit(parser);
+                    if (low >= 0xdc00 && low < 0xe000) {
+                        unit = 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+                    } else {
+                        parser->position = position;
+                    }
+                }
+                out = json_write_utf8(out, unit);
+                continue;
+            }
+            default:
+                free(string.cstring);
+                json_parse_fail(parser);
+        }
+        parser->position++;
+    }
+    parser->position++;
+    *out = '\0';
+    string.length = out - string.cstring;
+    return string;
+}
+
+static void json_push_value(JSJsonParser* parser, JSValue value) {
+    if (parser->values_count == parser->values_size) {
+        parser->values_size *= 2;
+        parser->values = realloc(parser->values, sizeof(JSValue) * parser->values_size);
+    }
+    parser->values[parser->values_count++] = value;
 }
 
-static JSObject* gc_stack_pop(JSObject* stack[], int* stack_counter) {
-    // *stack_counter = *stack_counter - 1;
-    (*stack_counter)--;
-    JSObject* object = stack[*stack_counter];
-    return object;
+static void json_push_key(JSJsonParser* parser, JSString key) {
+    if (parser->keys_count == parser->keys_size) {
+        parser->keys_size *= 2;
+        parser->keys = realloc(parser->keys, sizeof(JSString) * parser->keys_size);
+    }
+    parser->keys[parser->keys_count++] = key;
 }
 
-static JSObject* gc_run(JSEnv* env, va_list args) {
-    int i, j;
-
-#ifdef JS_GC_VERBOSE
-    fprintf(stderr, "gc start: %d\n", env->objects_count);
-#endif
+static JSValue json_parse_value(JSJsonParser* parser);
+
+// Elements and members are collected first, so that arrays and objects are
+// allocated with room for all their properties.
+static JSValue json_parse_array(JSJsonParser* parser) {
+    unsigned int first = parser->values_count;
+    JSObject* array;
+    parser->position++;
+    json_skip_whitespace(parser);
+    if (parser->position < parser->length && parser->text[parser->position] == ']') {
+        parser->position++;
+    } else {
+        while (1) {
+            json_push_value(parser, json_parse_value(parser));
+            json_skip_whitespace(parser);
+            if (parser->position >= parser->length) json_parse_fail(parser);
+            if (parser->text[parser->position] == ']') break;
+            if (parser->text[parser->position] != ',') json_parse_fail(parser);
+            parser->position++;
+        }
+        parser->position++;
+    }
+    array = object_new(parser->array_prototype);
+    js_gc_save_object(parser->env, array);
+    array_fill(array, parser->values + first, parser->values_count - first);
+    parser->values_count = first;
+    return js_object_value_from_object(array);
+}
 
-    for (i = 0; i < env->objects_count; i++) {
-        env->objects[i]->gc_mark = 0;
+static JSValue json_parse_object(JSJsonParser* parser) {
+    unsigned int first = parser->values_count, i;
+    JSObject* object;
+    parser->position++;
+    json_skip_whitespace(parser);
+    if (parser->position < parser->length && parser->text[parser->position] == '}') {
+        parser->position++;
+    } else {
+        while (1) {
+            json_skip_whitespace(parser);
+            if (parser->position >= parser->length || parser->text[parser->position] != '"') {
+                json_parse_fail(parser);
+            }
+            json_push_key(parser, json_parse_string(parser));
+            json_skip_whitespace(parser);
+            if (parser->position >= parser->length || parser->text[parser->position] != ':') {
+                json_parse_fail(parser);
+            }
+            parser->position++;
+            json_push_value(parser, json_parse_value(parser));
+            json_skip_whitespace(parser);
+            if (parser->position >= parser->length) json_parse_fail(parser);
+            if (parser->text[parser->position] == '}') break;
+            if (parser->text[parser->position] != ',') json_parse_fail(parser);
+            parser->position++;
+        }
+        parser->position++;
     }
+    object = js_construct_object(parser->env);
+    object_reserve(object, parser->values_count - first);
+    // later members with the same key replace earlier ones
+    for (i = first; i < parser->values_count; i++) {
+        object_set_property(object, parser->keys[parser->keys_count - parser->values_count + i], parser->values[i]);
+    }
+    parser->keys_count -= parser->values_count - first;
+    parser->values_count = first;
+    return js_object_value_from_object(object);
+}
 
-    JSObject* stack[JS_GC_STACK_DEPTH];
-    int stack_ptr = 0;
+static JSValue json_parse_value(JSJsonParser* parser) {
+    JSValue value;
+    json_skip_whitespace(parser);
+    if (parser->position >= parser->length) json_parse_fail(parser);
+    switch (parser->text[parser->position]) {
+        case '{':
+        case '[':
+            if (++parser->depth > JS_JSON_MAX_DEPTH) json_parse_fail(parser);
+            if (parser->text[parser->position] == '{') {
+                value = json_parse_object(parser);
+            } else {
+                value = json_parse_array(parser);
+            }
+            parser->depth--;
+            return value;
+        case '"':
+            return js_string_value_from_string(json_parse_string(parser));
+        case 't':
+            json_expect(parser, "true");
+            return js_new_boolean(1);
+        case 'f':
+            json_expect(parser, "false");
+            return js_new_boolean(0);
+        case 'n':
+            json_expect(parser, "null");
+            return js_new_null();
+        default:
+            return json_parse_number(parser);
+    }
+}
 
-    JSObject* object = NULL;
-    do {
-        object = va_arg(args, JSObject*);
-        gc_stack_push(stack, &stack_ptr, object);
-    } while (object != NULL);
+// JSON.parse(text) builds the value in a single pass over the text. Revivers
+// are not supported.
+JSValue js_json_parse(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JSValue text = stack_count > 0 ? JS_CALL_STACK_ITEM(0) : js_new_undefined();
+    JSValue reviver = stack_count > 1 ? JS_CALL_STACK_ITEM(1) : js_new_undefined();
+    JSJsonParser parser;
+    JSValue result;
+    JS_CALL_STACK_POP;
 
-    for (i = 0; i < env->call_stack_count; i++) {
-        JSValue value = env->call_stack[i];
-        if (value.type == TypeObject) {
-            gc_stack_push(stack, &stack_ptr, value.as.object);
-        }
+    if (JS_IS_FUNCTION(reviver)) {
+        JS_CALL_STACK_PUSH(js_string_value_from_cstring("JSON.parse reviver is not supported"));
+        js_throw(env, js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1));
     }
+    text = js_to_string(env, text);
+    parser.env = env;
+    parser.text = text.as.string.cstring;
+    parser.length = text.as.string.length;
+    parser.position = 0;
+    parser.depth = 0;
+    parser.values_size = 64;
+    parser.keys_size = 64;
+    parser.values_count = 0;
+    parser.keys_count = 0;
+    parser.array_prototype = js_get_property(env, intrinsic_value(env, IntrinsicArray),
+        js_string_value_from_cstring("prototype")).as.object;
+    parser.values = malloc(sizeof(JSValue) * parser.values_size);
+    parser.keys = malloc(sizeof(JSString) * parser.keys_size);
+
+    result = json_parse_value(&parser);
+    json_skip_whitespace(&parser);
+    if (parser.position < parser.length) json_parse_fail(&parser);
+    free(parser.values);
+    free(parser.keys);
+    return result;
+}
 
-    while (stack_ptr > 0) {
-        JSObject* object = gc_stack_pop(stack, &stack_ptr);
-        for (j = 0; j < object->properties_count; j++) {
-            JSValue value = object->properties[j].value;
-            if (value.type == TypeObject) {
-                gc_stack_push(stack, &stack_ptr, value.as.object);
-            }
-        }
-        gc_stack_push(stack, &stack_ptr, object->prototype);
-        if (object->class == ClassFunction) {
-            gc_stack_push(stack, &stack_ptr, ((JSFunctionObject*) object)->binding);
+typedef struct {
+    JSEnv* env;
+    char* data;
+    size_t length;
+    size_t size;
+    // indentation of one level, empty for compact output
+    JSString indent;
+    // objects being written, for detecting cycles
+    JSObject** stack;
+    unsigned int depth;
+} JSJsonWriter;
+
+static void json_reserve(JSJsonWriter* writer, size_t length) {
+    if (writer->length + length > writer->size) {
+        while (writer->length + length > writer->size) {
+            writer->size *= 2;
         }
+        writer->data = realloc(writer->data, writer->size);
     }
+}
 
-    for (i = 0; i < env->objects_count; i++) {
-        if (env->objects[i]->gc_mark == 0) {
-            object_destroy(env->objects[i]);
-            env->objects[i] = NULL;
+static void json_write(JSJsonWriter* writer, const char* data, size_t length) {
+    json_reserve(writer, length);
+    memcpy(writer->data + writer->length, data, length);
+    writer->length += length;
+}
+
+static void json_write_char(JSJsonWriter* writer, char c) {
+    json_reserve(writer, 1);
+    writer->data[writer->length++] = c;
+}
+
+static void json_write_string(JSJsonWriter* writer, JSString string) {
+    static const char* hex = "0123456789abcdef";
+    unsigned int position = 0, run;
+    json_write_char(writer, '"');
+    while (position < string.length) {
+        run = position;
+        position = json_scan_string(string.cstring, position, string.length);
+        json_write(writer, string.cstring + run, position - run);
+        if (position == string.length) break;
+
+        unsigned char c = string.cstring[position++];
+        char escape[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+        switch (c) {
+            case '"': json_write(writer, "\\\"", 2); break;
+            case '\\': json_write(writer, "\\\\", 2); break;
+            case '\b': json_write(writer, "\\b", 2); break;
+            case '\f': json_write(writer, "\\f", 2); break;
+            case '\n': json_write(writer, "\\n", 2); break;
+            case '\r': json_write(writer, "\\r", 2); break;
+            case '\t': json_write(writer, "\\t", 2); break;
+            default: json_write(writer, escape, 6);
         }
     }
+    json_write_char(writer, '"');
+}
 
-    j = 0;
-    for (i = 0; i < env->objects_count; i++) {
-        if (env->objects[i] != NULL) {
-            env->objects[j] = env->objects[i];
-            j++;
-        }
+static void json_write_newline(JSJsonWriter* writer) {
+    unsigned int i;
+    if (writer->indent.length == 0) return;
+    json_write_char(writer, '\n');
+    for (i = 0; i < writer->depth; i++) {
+        json_write(writer, writer->indent.cstring, writer->indent.length);
     }
-    env->objects_count = j;
-    env->gc_last_objects_count = env->objects_count;
+}
 
-#ifdef JS_GC_VERBOSE
-    fprintf(stderr, "gc end: %d\n", env->objects_count);
-#endif
+static void json_stringify_fail(JSJsonWriter* writer, char* message) {
+    JSEnv* env = writer->env;
+    free(writer->data);
+    free(writer->stack);
+    JS_CALL_STACK_PUSH(js_string_value_from_cstring(message));
+    js_throw(env, js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1));
 }
 
-int js_gc_should_run(JSEnv* env) {
-    return env->objects_count > JS_GC_THRESHOLD && env->objects_count > 2 * env->gc_last_objects_count;
+// Undefined and functions are left out of objects and written as null in
+// arrays.
+static int json_is_written(JSValue value) {
+    return value.type != TypeUndefined && !JS_IS_FUNCTION(value);
 }
 
-void js_gc_run(JSEnv* env, ...) {
-    va_list args;
-    va_start(args, env);
-    gc_run(env, args);
-    va_end(args);
+static void json_write_value(JSJsonWriter* writer, JSValue value) {
+    char number[16];
+    JSObject* object;
+    unsigned int i;
+    int written = 0;
+
+    if (value.type == TypeObject && value.as.object != NULL && value.as.object->primitive.type != TypeUndefined) {
+        value = value.as.object->primitive;
+    }
+    switch (value.type) {
+        case TypeNumber:
+            json_write(writer, number, sprintf(number, "%d", value.as.number));
+            return;
+        case TypeString:
+            json_write_string(writer, value.as.string);
+            return;
+        case TypeBoolean:
+            if (value.as.boolean) {
+                json_write(writer, "true", 4);
+            } else {
+                json_write(writer, "false", 5);
+            }
+            return;
+        case TypeUndefined:
+            json_write(writer, "null", 4);
+            return;
+        case TypeObject:
+            break;
+    }
+    object = value.as.object;
+    if (object == NULL || object->class == ClassFunction) {
+        json_write(writer, "null", 4);
+        return;
+    }
+    for (i = 0; i < writer->depth; i++) {
+        if (writer->stack[i] == object) json_stringify_fail(writer, "Converting circular structure to JSON");
+    }
+    if (writer->depth == JS_JSON_MAX_DEPTH) json_stringify_fail(writer, "JSON nesting is too deep");
+    writer->stack[writer->depth++] = object;
+
+    if (object->class == ClassArray) {
+        JSValue length = object_get_own_property(object, string_from_cstring("length"));
+        int count = length.type == TypeNumber ? length.as.number : 0;
+        json_write_char(writer, '[');
+        for (i = 0; i < count; i++) {
+            JSString key;
+            if (i > 0) json_write_char(writer, ',');
+            json_write_newline(writer);
+            key.cstring = number;
+            key.length = sprintf(number, "%u", i);
+            JSValue element = object_get_own_property(object, key);
+            if (json_is_written(element)) {
+                json_write_value(writer, element);
+            } else {
+                json_write(writer, "null", 4);
+            }
+        }
+        written = count > 0;
+    } else {
+        json_write_char(writer, '{');
+        for (i = 0; i < object->properties_count; i++) {
+            JSProperty* property = &object->properties[i];
+            if (!json_is_written(property->value)) continue;
+            if (written) json_write_char(writer, ',');
+            json_write_newline(writer);
+            json_write_string(writer, property->key);
+            json_write_char(writer, ':');
+            if (writer->indent.length > 0) json_write_char(writer, ' ');
+            json_write_value(writer, property->value);
+            written = 1;
+        }
+    }
+    writer->depth--;
+    if (written) json_write_newline(writer);
+    json_write_char(writer, object->class == ClassArray ? ']' : '}');
+}
+
+// JSON.stringify(value, replacer, space) writes to a buffer which grows as
+// needed. Replacers are not supported; space is a number of spaces (up to 10)
+// or a string (its first 10 characters).
+JSValue js_json_stringify(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JSValue value = stack_count > 0 ? JS_CALL_STACK_ITEM(0) : js_new_undefined();
+    JSValue replacer = stack_count > 1 ? JS_CALL_STACK_ITEM(1) : js_new_undefined();
+    JSValue space = stack_count > 2 ? JS_CALL_STACK_ITEM(2) : js_new_undefined();
+    JSJsonWriter writer;
+    JSString result;
+    JS_CALL_STACK_POP;
+
+    if (replacer.type == TypeObject && replacer.as.object != NULL) {
+        JS_CALL_STACK_PUSH(js_string_value_from_cstring("JSON.stringify replacer is not supported"));
+        js_throw(env, js_invoke_constructor(env, intrinsic_value(env, IntrinsicTypeError), 1));
+    }
+    if (!json_is_written(value)) {
+        return js_new_undefined();
+    }
+    writer.indent.cstring = "          ";
+    writer.indent.length = 0;
+    if (space.type == TypeNumber && space.as.number > 0) {
+        writer.indent.length = space.as.number < 10 ? space.as.number : 10;
+    } else if (space.type == TypeString) {
+        writer.indent.cstring = space.as.string.cstring;
+        writer.indent.length = space.as.string.length < 10 ? space.as.string.length : 10;
+    }
+    writer.env = env;
+    writer.size = 256;
+    writer.length = 0;
+    writer.data = malloc(writer.size);
+    writer.stack = malloc(sizeof(JSObject*) * JS_JSON_MAX_DEPTH);
+    writer.depth = 0;
+
+    json_write_value(&writer, value);
+    free(writer.stack);
+    json_write_char(&writer, '\0');
+    result.cstring = writer.data;
+    result.length = writer.length - 1;
+#ifdef JS_ALLOC_PROFILE
+    alloc_profile_string(env, writer.size);
+#endif
+    return js_string_value_from_string(result);
 }
 
 // --- built-in objects -------------------------------------------------------
@@ -957,6 +3697,9 @@ JSValue js_object_has_own_property(JSEnv* env, JSValue this, int stack_count, JS
     JS_CALL_STACK_POP;
 
     this = js_to_object(env, this);
+    if (is_prototype_key(key.as.string)) {
+        function_prototype_materialize(env, this.as.object);
+    }
     return js_new_boolean(object_has_own_property(this.as.object, key.as.string));
 }
 
@@ -1004,6 +3747,11 @@ JSValue js_function_prototype_apply(JSEnv* env, JSValue this, int stack_count, J
 
 JSValue js_array_constructor(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
     int i = 0;
+    if (this.as.object->properties_count == 0) {
+        array_fill(this.as.object, &JS_CALL_STACK_ITEM(0), stack_count);
+        JS_CALL_STACK_POP;
+        return this;
+    }
     while (i < stack_count) {
         object_set_property(this.as.object,
             js_to_string(env, js_new_number(i)).as.string, JS_CALL_STACK_ITEM(i));
@@ -1082,33 +3830,129 @@ JSValue js_string_substring(JSEnv* env, JSValue this, int stack_count, JSObject*
 }
 
 JSValue js_string_index_of(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
-    char *string = js_to_string(env, this).as.string.cstring;
-    int i = 0, j;
-    JSValue js_substring, js_position;
-    if (stack_count == 0) {
-        js_substring = js_new_undefined();
-    } else {
-        js_substring = JS_CALL_STACK_ITEM(0);
+    JSString string = js_to_string(env, this).as.string;
+    JSValue search = js_new_undefined();
+    int from = 0;
+    if (stack_count > 0) {
+        search = JS_CALL_STACK_ITEM(0);
+    }
+    if (stack_count > 1) {
+        from = js_to_number(env, JS_CALL_STACK_ITEM(1)).as.number;
+    }
+    JS_CALL_STACK_POP;
+
+    return js_new_number(string_find(string, js_to_string(env, search).as.string, from));
+}
+
+JSValue js_string_last_index_of(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JSString string = js_to_string(env, this).as.string;
+    JSValue search = js_new_undefined();
+    int from = string.length;
+    if (stack_count > 0) {
+        search = JS_CALL_STACK_ITEM(0);
+    }
+    if (stack_count > 1 && JS_CALL_STACK_ITEM(1).type != TypeUndefined) {
+        from = js_to_number(env, JS_CALL_STACK_ITEM(1)).as.number;
+    }
+    JS_CALL_STACK_POP;
+
+    return js_new_number(string_find_last(string, js_to_string(env, search).as.string, from));
+}
+
+// Parts of the result share memory with the original string.
+JSValue js_string_split(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JSString string = js_to_string(env, this).as.string;
+    JSValue separator = js_new_undefined();
+    unsigned int limit = -1, count = 0;
+    if (stack_count > 0) {
+        separator = JS_CALL_STACK_ITEM(0);
+    }
+    if (stack_count > 1 && JS_CALL_STACK_ITEM(1).type != TypeUndefined) {
+        limit = js_to_number(env, JS_CALL_STACK_ITEM(1)).as.number;
     }
-    if (stack_count == 1) {
-        js_position = js_new_undefined();
+    JS_CALL_STACK_POP;
+
+    JSString search;
+    if (separator.type != TypeUndefined) {
+        search = js_to_string(env, separator).as.string;
+    }
+    JSValue result = js_invoke_constructor(env, intrinsic_value(env, IntrinsicArray), 0);
+    if (limit == 0) {
+        return result;
+    }
+    if (separator.type == TypeUndefined) {
+        js_set_property(env, result, js_new_number(0), js_string_value_from_string(string));
+    } else if (search.length == 0) {
+        while (count < string.length && count < limit) {
+            js_set_property(env, result, js_new_number(count), js_string_value_from_string(string_char_at(string, count)));
+            count++;
+        }
     } else {
-        js_position = JS_CALL_STACK_ITEM(1);
-        i = js_to_number(env, js_position).as.number;
+        int from = 0, i;
+        while (count < limit && (i = string_find(string, search, from)) != -1) {
+            js_set_property(env, result, js_new_number(count++), js_string_value_from_string(string_slice(string, from, i)));
+            from = i + search.length;
+        }
+        if (count < limit) {
+            js_set_property(env, result, js_new_number(count), js_string_value_from_string(string_slice(string, from, string.length)));
+        }
+    }
+    return result;
+}
+
+// Replaces all occurrences of pattern, like split(pattern).join(replacement)
+// did when it was implemented in runtime.js. An empty pattern matches between
+// characters.
+JSValue js_string_replace(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JSString string = js_to_string(env, this).as.string;
+    JSValue pattern_value = js_new_undefined(), replacement_value = js_new_undefined();
+    if (stack_count > 0) {
+        pattern_value = JS_CALL_STACK_ITEM(0);
+    }
+    if (stack_count > 1) {
+        replacement_value = JS_CALL_STACK_ITEM(1);
     }
     JS_CALL_STACK_POP;
+    JSString pattern = js_to_string(env, pattern_value).as.string;
+    JSString replacement = js_to_string(env, replacement_value).as.string;
 
-    char *substring = js_to_string(env, js_substring).as.string.cstring;
-    int string_len = strlen(string);
-    int substring_len = strlen(substring);
+    unsigned int matches = 0;
+    int i = -1, from = 0;
+    if (pattern.length == 0) {
+        matches = string.length > 0 ? string.length - 1 : 0;
+    } else {
+        while ((i = string_find(string, pattern, from)) != -1) {
+            matches++;
+            from = i + pattern.length;
+        }
+    }
+    if (matches == 0) {
+        return js_string_value_from_string(string);
+    }
 
-    for (; i < string_len - substring_len; i++) {
-        for (j = 0; j < substring_len; j++) {
-            if (string[i+j] != substring[j]) break;
+    unsigned int length = string.length - matches * pattern.length + matches * replacement.length;
+    char* new_cstring = malloc(sizeof(char) * (length + 1));
+    char* out = new_cstring;
+    from = 0;
+    while (matches > 0) {
+        if (pattern.length == 0) {
+            i = from + 1;
+        } else {
+            i = string_find(string, pattern, from);
         }
-        if (j == substring_len) return js_new_number(i);
+        memcpy(out, string.cstring + from, i - from);
+        out += i - from;
+        memcpy(out, replacement.cstring, replacement.length);
+        out += replacement.length;
+        from = i + pattern.length;
+        matches--;
     }
-    return js_new_number(-1);
+    memcpy(out, string.cstring + from, string.length - from);
+    new_cstring[length] = '\0';
+#ifdef JS_ALLOC_PROFILE
+    alloc_profile_string(env, length + 1);
+#endif
+    return js_string_value_from_cstring(new_cstring);
 }
 
 JSValue js_string_slice(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
@@ -1121,52 +3965,140 @@ JSValue js_string_slice(JSEnv* env, JSValue this, int stack_count, JSObject* bin
     return js_string_value_from_string(string);
 }
 
+// Writes the string and a newline. stdio buffers the output, strings are
+// written without copying, whether or not they are terminated. The lock keeps
+// lines written by workers whole.
+static void write_line(FILE* out, JSString string) {
+    flockfile(out);
+    fwrite(string.cstring, 1, string.length, out);
+    putc('\n', out);
+    funlockfile(out);
+}
+
 JSValue js_console_log(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
-    printf("%s\n", string_to_cstring(js_to_string(env, JS_CALL_STACK_ITEM(0)).as.string));
+    write_line(stdout, js_to_string(env, JS_CALL_STACK_ITEM(0)).as.string);
     JS_CALL_STACK_POP;
     return js_new_undefined();
 }
 
 JSValue js_console_error(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
-    fprintf(stderr, "%s\n", string_to_cstring(js_to_string(env, JS_CALL_STACK_ITEM(0)).as.string));
+    fflush(stdout);
+    write_line(stderr, js_to_string(env, JS_CALL_STACK_ITEM(0)).as.string);
     JS_CALL_STACK_POP;
     return js_new_undefined();
 }
 
+// With JS_MMAP_FILES, files are mapped to memory instead of being read. The
+// resulting string points to the mapping, so the file must not change while
+// the program runs. Files which fill whole pages are still read, because the
+// mapping must be followed by a terminating zero.
+#ifdef JS_MMAP_FILES
+static char* read_file_mmap(FILE* fp, long size) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (size == 0 || size % page_size == 0) {
+        return NULL;
+    }
+    char* contents = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    return contents == MAP_FAILED ? NULL : contents;
+}
+#endif
+
+// readFileSync(name) returns contents of the file as a string, like with an
+// encoding in Node. readFileSync(name, null) returns them as a Uint8Array.
 JSValue js_read_file(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
     char* file_name = string_to_cstring(js_to_string(env, JS_CALL_STACK_ITEM(0)).as.string);
+    int bytes = stack_count > 1 && JS_CALL_STACK_ITEM(1).type == TypeObject && JS_CALL_STACK_ITEM(1).as.object == NULL;
     JS_CALL_STACK_POP;
     FILE *fp = fopen(file_name, "rb");
     if (fp == NULL) js_throw(env, js_string_value_from_cstring("Cannot open file"));
 
     fseek(fp, 0, SEEK_END);
-    int size = ftell(fp);
+    long size = ftell(fp);
     fseek(fp, 0, SEEK_SET);
 
-    char* contents = malloc(sizeof(char) * (size + 1));
-    fread(contents, 1, size, fp);
+    JSString string;
+    if (bytes) {
+        unsigned char* data = malloc(size + 1);
+        size = fread(data, 1, size, fp);
+        fclose(fp);
+        return js_object_value_from_object((JSObject*) typed_array_new(env, ClassUint8Array,
+            array_buffer_new(env, data, size), 0, size));
+    }
+#ifdef JS_MMAP_FILES
+    string.cstring = read_file_mmap(fp, size);
+    if (string.cstring != NULL) {
+        fclose(fp);
+        string.length = size;
+        return js_string_value_from_string(string);
+    }
+#endif
+    string.cstring = malloc(sizeof(char) * (size + 1));
+    string.length = fread(string.cstring, 1, size, fp);
     fclose(fp);
-    contents[size] = '\0';
-    return js_string_value_from_cstring(contents);
+    string.cstring[string.length] = '\0';
+    return js_string_value_from_string(string);
 }
 
-JSValue js_write_file(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+static JSValue write_file(JSEnv* env, int stack_count, char* mode) {
     char* file_name = string_to_cstring(js_to_string(env, JS_CALL_STACK_ITEM(0)).as.string);
-    char* contents = string_to_cstring(js_to_string(env, JS_CALL_STACK_ITEM(1)).as.string);
+    JSString contents = js_to_string(env, JS_CALL_STACK_ITEM(1)).as.string;
     JS_CALL_STACK_POP;
-    FILE *fp = fopen(file_name, "wb");
+    FILE *fp = fopen(file_name, mode);
     if (fp == NULL) js_throw(env, js_string_value_from_cstring("Cannot open file"));
-    fwrite(contents, 1, strlen(contents), fp);
+    fwrite(contents.cstring, 1, contents.length, fp);
     fclose(fp);
     return js_new_undefined();
 }
 
+JSValue js_write_file(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    return write_file(env, stack_count, "wb");
+}
+
+// Lets programs write output in pieces, instead of concatenating it first.
+JSValue js_append_file(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    return write_file(env, stack_count, "ab");
+}
+
 JSValue js_system(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
     char* command = string_to_cstring(js_to_string(env, JS_CALL_STACK_ITEM(0)).as.string);
     JS_CALL_STACK_POP;
+    // the command may write to the same files
+    fflush(NULL);
     return js_new_number(system(command));
 }
 
+// Numbers are ints, so larger totals are capped at 2^31 - 1.
+static void gc_stats_set(JSEnv* env, JSValue stats, char* key, unsigned long long value) {
+    js_set_property(env, stats, js_string_value_from_cstring(key),
+        js_new_number(value < INT_MAX ? value : INT_MAX));
+}
+
+// gc.stats() returns statistics of the garbage collector. Times are in
+// microseconds.
+JSValue js_gc_stats(JSEnv* env, JSValue this, int stack_count, JSObject* binding) {
+    JS_CALL_STACK_POP;
+    JSGCStats* stats = &env->gc_stats;
+    JSValue result = js_construct_object_value(env);
+    gc_stats_set(env, result, "cycles", stats->cycles);
+    gc_stats_set(env, result, "pauseUs", stats->last_pause_ns / 1000);
+    gc_stats_set(env, result, "totalPauseUs", stats->total_pause_ns / 1000);
+    gc_stats_set(env, result, "maxPauseUs", stats->max_pause_ns / 1000);
+    gc_stats_set(env, result, "objectsBefore", stats->objects_before);
+    gc_stats_set(env, result, "objectsAfter", stats->objects_after);
+    gc_stats_set(env, result, "bytesBefore", stats->bytes_before);
+    gc_stats_set(env, result, "bytesAfter", stats->bytes_after);
+    gc_stats_set(env, result, "propertyBytes", stats->property_bytes_after);
+    gc_stats_set(env, result, "maxBytes", stats->max_bytes_before);
+    gc_stats_set(env, result, "markStackDepth", stats->mark_stack_depth);
+    gc_stats_set(env, result, "maxMarkStackDepth", stats->max_mark_stack_depth);
+    gc_stats_set(env, result, "markStackOverflows", stats->mark_stack_overflows);
+    gc_stats_set(env, result, "triggerLimit", stats->trigger_limit);
+    gc_stats_set(env, result, "threshold", JS_GC_THRESHOLD);
+    gc_stats_set(env, result, "heapObjects", env->objects_count);
+    js_set_property(env, result, js_string_value_from_cstring("trigger"), js_string_value_from_cstring((char*) stats->trigger));
+    return result;
+}
+
 void js_create_native_objects(JSEnv* env) {
     JSValue global = env->global;
     js_set_property(env, global, js_string_value_from_cstring("global"), global);
@@ -1177,6 +4109,7 @@ void js_create_native_objects(JSEnv* env) {
             (JSObject*) function_object_new(NULL, &js_object_constructor, NULL));
     js_gc_save_object(env, object_prototype.as.object);
     js_gc_save_object(env, object_constructor.as.object);
+    env->intrinsics[IntrinsicObjectPrototype] = object_prototype.as.object;
     js_set_property(env, object_constructor, js_string_value_from_cstring("prototype"), object_prototype);
     js_set_property(env, object_prototype, js_string_value_from_cstring("constructor"), object_constructor);
     js_set_property(env, global, js_string_value_from_cstring("Object"), object_constructor);
@@ -1185,6 +4118,7 @@ void js_create_native_objects(JSEnv* env) {
         js_object_value_from_object(
             (JSObject*) function_object_new(object_prototype.as.object, &js_function_constructor, NULL));
     JSValue function_prototype = js_construct_object_value(env);
+    env->intrinsics[IntrinsicFunctionPrototype] = function_prototype.as.object;
     js_gc_save_object(env, function_constructor.as.object);
     js_set_property(env, function_constructor, js_string_value_from_cstring("prototype"), function_prototype);
     js_set_property(env, function_prototype, js_string_value_from_cstring("constructor"), function_constructor);
@@ -1201,21 +4135,27 @@ void js_create_native_objects(JSEnv* env) {
 
     JSValue array_constructor = js_construct_function_object_value(env, &js_array_constructor, NULL);
     js_set_property(env, global, js_string_value_from_cstring("Array"), array_constructor);
+    env->intrinsics[IntrinsicArray] = array_constructor.as.object;
 
     JSValue number_constructor = js_construct_function_object_value(env, &js_number_constructor, NULL);
     JSValue number_prototype = js_get_property(env, number_constructor, js_string_value_from_cstring("prototype"));
     js_set_property(env, global, js_string_value_from_cstring("Number"), number_constructor);
+    env->intrinsics[IntrinsicNumber] = number_constructor.as.object;
     js_set_property(env, number_prototype, js_string_value_from_cstring("valueOf"), js_construct_function_object_value(env, &js_number_value_of, NULL));
     js_set_property(env, number_prototype, js_string_value_from_cstring("toString"), js_construct_function_object_value(env, &js_number_to_string, NULL));
 
     JSValue string_constructor = js_construct_function_object_value(env, &js_string_constructor, NULL);
     JSValue string_prototype = js_get_property(env, string_constructor, js_string_value_from_cstring("prototype"));
     js_set_property(env, global, js_string_value_from_cstring("String"), string_constructor);
+    env->intrinsics[IntrinsicString] = string_constructor.as.object;
     js_set_property(env, string_prototype, js_string_value_from_cstring("valueOf"), js_construct_function_object_value(env, &js_string_value_of, NULL));
     js_set_property(env, string_prototype, js_string_value_from_cstring("toString"), js_construct_function_object_value(env, &js_string_to_string, NULL));
     js_set_property(env, string_prototype, js_string_value_from_cstring("charAt"), js_construct_function_object_value(env, &js_string_char_at, NULL));
     js_set_property(env, string_prototype, js_string_value_from_cstring("substring"), js_construct_function_object_value(env, &js_string_substring, NULL));
     js_set_property(env, string_prototype, js_string_value_from_cstring("indexOf"), js_construct_function_object_value(env, &js_string_index_of, NULL));
+    js_set_property(env, string_prototype, js_string_value_from_cstring("lastIndexOf"), js_construct_function_object_value(env, &js_string_last_index_of, NULL));
+    js_set_property(env, string_prototype, js_string_value_from_cstring("split"), js_construct_function_object_value(env, &js_string_split, NULL));
+    js_set_property(env, string_prototype, js_string_value_from_cstring("replace"), js_construct_function_object_value(env, &js_string_replace, NULL));
     js_set_property(env, string_prototype, js_string_value_from_cstring("slice"), js_construct_function_object_value(env, &js_string_slice, NULL));
 
     JSValue console = js_construct_object_value(env);
@@ -1223,9 +4163,40 @@ void js_create_native_objects(JSEnv* env) {
     js_set_property(env, console, js_string_value_from_cstring("error"), js_construct_function_object_value(env, &js_console_error, NULL));
     js_set_property(env, global, js_string_value_from_cstring("console"), console);
 
+    JSValue array_buffer_constructor = js_construct_function_object_value(env, &js_array_buffer_constructor, NULL);
+    js_set_property(env, global, js_string_value_from_cstring("ArrayBuffer"), array_buffer_constructor);
+    env->intrinsics[IntrinsicArrayBufferPrototype] =
+        js_get_property(env, array_buffer_constructor, js_string_value_from_cstring("prototype")).as.object;
+    JSValue int32_array_constructor = js_construct_function_object_value(env, &js_int32_array_constructor, NULL);
+    js_set_property(env, global, js_string_value_from_cstring("Int32Array"), int32_array_constructor);
+    env->intrinsics[IntrinsicInt32ArrayPrototype] =
+        js_get_property(env, int32_array_constructor, js_string_value_from_cstring("prototype")).as.object;
+    JSValue uint8_array_constructor = js_construct_function_object_value(env, &js_uint8_array_constructor, NULL);
+    js_set_property(env, global, js_string_value_from_cstring("Uint8Array"), uint8_array_constructor);
+    env->intrinsics[IntrinsicUint8ArrayPrototype] =
+        js_get_property(env, uint8_array_constructor, js_string_value_from_cstring("prototype")).as.object;
+
+    JSValue json = js_construct_object_value(env);
+    js_set_property(env, json, js_string_value_from_cstring("parse"), js_construct_function_object_value(env, &js_json_parse, NULL));
+    js_set_property(env, json, js_string_value_from_cstring("stringify"), js_construct_function_object_value(env, &js_json_stringify, NULL));
+    js_set_property(env, global, js_string_value_from_cstring("JSON"), json);
+
+    JSValue gc = js_construct_object_value(env);
+    js_set_property(env, gc, js_string_value_from_cstring("stats"), js_construct_function_object_value(env, &js_gc_stats, NULL));
+    js_set_property(env, global, js_string_value_from_cstring("gc"), gc);
+    js_set_property(env, global, js_string_value_from_cstring("stats"), js_construct_function_object_value(env, &js_stats, NULL));
+
+    JSValue worker_constructor = js_construct_function_object_value(env, &js_worker_constructor, NULL);
+    JSValue worker_prototype = js_get_property(env, worker_constructor, js_string_value_from_cstring("prototype"));
+    js_set_property(env, global, js_string_value_from_cstring("Worker"), worker_constructor);
+    js_set_property(env, worker_prototype, js_string_value_from_cstring("receive"), js_construct_function_object_value(env, &js_worker_receive, NULL));
+    js_set_property(env, worker_prototype, js_string_value_from_cstring("join"), js_construct_function_object_value(env, &js_worker_join, NULL));
+
     js_set_property(env, global, js_string_value_from_cstring("readFileSync"), js_construct_function_object_value(env, &js_read_file, NULL));
     js_set_property(env, global, js_string_value_from_cstring("writeFileSync"), js_construct_function_object_value(env, &js_write_file, NULL));
+    js_set_property(env, global, js_string_value_from_cstring("appendFileSync"), js_construct_function_object_value(env, &js_append_file, NULL));
     js_set_property(env, global, js_string_value_from_cstring("system"), js_construct_function_object_value(env, &js_system, NULL));
+    js_set_property(env, global, js_string_value_from_cstring("runBytecode"), js_construct_function_object_value(env, &js_run_bytecode, NULL));
 }
 
 void js_create_argv(JSEnv* env, int argc, char** argv) {
@@ -1233,6 +4204,287 @@ void js_create_argv(JSEnv* env, int argc, char** argv) {
     for (i = 0; i < argc; i++) {
         JS_CALL_STACK_PUSH(js_string_value_from_cstring(argv[i]));
     }
-    JSValue js_argv = js_invoke_constructor(env, js_get_global(env, string_from_cstring("Array")), argc);
+    JSValue js_argv = js_invoke_constructor(env, intrinsic_value(env, IntrinsicArray), argc);
     js_set_property(env, env->global, js_string_value_from_cstring("argv"), js_argv);
 }
+
+// Frees objects and stacks of the environment. Strings are not freed, like
+// elsewhere in the runtime; workers it started keep running.
+void js_env_destroy(JSEnv* env) {
+    unsigned int i;
+    for (i = 0; i < env->objects_count; i++) {
+        object_destroy(env->objects[i]);
+    }
+    free(env->objects);
+    free(env->gc_mark_stack);
+    free(env->call_stack);
+    free(env->for_in);
+    free(env->global_cells);
+    free(env->workers);
+    free(env);
+}
+
+// --- heap snapshots ---------------------------------------------------------
+
+// Programs built normally create native objects and run the prelude
+// (runtime.js) at start. Run with JS_SNAPSHOT_OUT=file, they write the
+// resulting heap to file as C source and exit. The same program compiled
+// with -DJS_SNAPSHOT='"file"' loads the heap from the image instead. The
+// image matches only the C source it was written by.
+
+// Natives which may be referenced from the heap, numbered by position.
+static JSValue (*snapshot_natives[])() = {
+    &js_object_constructor, &js_object_is_prototype_of, &js_object_has_own_property,
+    &js_function_constructor, &js_function_prototype_call, &js_function_prototype_apply,
+    &js_array_constructor,
+    &js_number_constructor, &js_number_value_of, &js_number_to_string,
+    &js_string_constructor, &js_string_value_of, &js_string_to_string, &js_string_char_at,
+    &js_string_substring, &js_string_index_of, &js_string_last_index_of, &js_string_split,
+    &js_string_replace, &js_string_slice,
+    &js_console_log, &js_console_error,
+    &js_read_file, &js_write_file, &js_append_file, &js_system,
+    &js_gc_stats,
+    &js_json_parse, &js_json_stringify,
+    &js_array_buffer_constructor, &js_int32_array_constructor, &js_uint8_array_constructor,
+    &js_worker_constructor, &js_worker_post_message, &js_worker_receive, &js_worker_join,
+    &js_run_bytecode, &js_stats,
+    NULL
+};
+
+static unsigned int snapshot_count_functions(JSValue (**functions)()) {
+    unsigned int count = 0;
+    while (functions[count] != NULL) count++;
+    return count;
+}
+
+// Positions of objects in the image, found by address.
+typedef struct {
+    JSObject** objects;
+    unsigned int* positions;
+    unsigned int mask;
+} JSSnapshotIndex;
+
+static unsigned int snapshot_index_slot(JSSnapshotIndex* index, JSObject* object) {
+    unsigned int slot = ((size_t) object >> 4) & index->mask;
+    while (index->objects[slot] != NULL && index->objects[slot] != object) {
+        slot = (slot + 1) & index->mask;
+    }
+    return slot;
+}
+
+static unsigned int snapshot_object_reference(JSSnapshotIndex* index, JSObject* object) {
+    if (object == NULL) {
+        return 0;
+    }
+    return index->positions[snapshot_index_slot(index, object)];
+}
+
+static unsigned int snapshot_function_reference(JSValue (*function)(), JSValue (**functions)()) {
+    unsigned int i, natives_count = snapshot_count_functions(snapshot_natives);
+    for (i = 0; i < natives_count; i++) {
+        if (snapshot_natives[i] == function) return i + 1;
+    }
+    for (i = 0; functions[i] != NULL; i++) {
+        if (functions[i] == function) return natives_count + i + 1;
+    }
+    fprintf(stderr, "Heap snapshot: unknown function\n");
+    exit(1);
+}
+
+// Writes bytes as a C string literal. Octal escapes have three digits, so
+// that following characters can't extend them.
+static void snapshot_write_cstring(FILE* out, char* cstring, unsigned int length) {
+    unsigned int i;
+    putc('"', out);
+    for (i = 0; i < length; i++) {
+        unsigned char c = cstring[i];
+        if (c < 32 || c > 126 || c == '"' || c == '\\' || c == '?') {
+            fprintf(out, "\\%03o", c);
+        } else {
+            putc(c, out);
+        }
+    }
+    putc('"', out);
+}
+
+static void snapshot_write_value(FILE* out, JSSnapshotIndex* index, JSValue value) {
+    static char* types[] = { "TypeUndefined", "TypeNumber", "TypeString", "TypeBoolean", "TypeObject" };
+    fprintf(out, "{ %s, ", types[value.type]);
+    switch (value.type) {
+        case TypeNumber:
+            fprintf(out, "%d, NULL, 0 }", value.as.number);
+            break;
+        case TypeBoolean:
+            fprintf(out, "%d, NULL, 0 }", value.as.boolean);
+            break;
+        case TypeString:
+            fprintf(out, "0, ");
+            snapshot_write_cstring(out, value.as.string.cstring, value.as.string.length);
+            fprintf(out, ", %u }", value.as.string.length);
+            break;
+        case TypeObject:
+            fprintf(out, "%u, NULL, 0 }", snapshot_object_reference(index, value.as.object));
+            break;
+        default:
+            fprintf(out, "0, NULL, 0 }");
+    }
+}
+
+static void snapshot_write(JSEnv* env, FILE* out, JSValue (**functions)()) {
+    static char* classes[] = { "ClassObject", "ClassFunction", "ClassArray", "ClassWorker" };
+    JSSnapshotIndex index;
+    unsigned int i, j, size = 2, properties = 0;
+
+    js_gc_run(env, env->global.as.object, NULL);
+    while (size < 2 * env->objects_count) {
+        size *= 2;
+    }
+    index.objects = calloc(size, sizeof(JSObject*));
+    index.positions = malloc(sizeof(unsigned int) * size);
+    index.mask = size - 1;
+    for (i = 0; i < env->objects_count; i++) {
+        unsigned int slot = snapshot_index_slot(&index, env->objects[i]);
+        index.objects[slot] = env->objects[i];
+        index.positions[slot] = i + 1;
+    }
+
+    fprintf(out, "// Heap snapshot, see js_snapshot_load in js.c.\n");
+    fprintf(out, "static JSSnapshotObject js_snapshot_objects[] = {\n");
+    for (i = 0; i < env->objects_count; i++) {
+        JSObject* object = env->objects[i];
+        unsigned int function = 0, binding = 0;
+        if (JS_IS_BUFFER_OBJECT(object)) {
+            fprintf(stderr, "Typed arrays can't be saved in a heap snapshot\n");
+            exit(1);
+        }
+        if (object->class == ClassFunction) {
+            function = snapshot_function_reference(((JSFunctionObject*) object)->function, functions);
+            binding = snapshot_object_reference(&index, ((JSFunctionObject*) object)->binding);
+        }
+        fprintf(out, "    { %s, %u, %u, %u, ", classes[object->class],
+            snapshot_object_reference(&index, object->prototype), function, binding);
+        snapshot_write_value(out, &index, object->primitive);
+        fprintf(out, ", %u, %u, %d },\n", properties, object->properties_count, object->lazy_prototype);
+        properties += object->properties_count;
+    }
+    fprintf(out, "};\n");
+
+    fprintf(out, "static JSSnapshotProperty js_snapshot_properties[] = {\n");
+    for (i = 0; i < env->objects_count; i++) {
+        JSObject* object = env->objects[i];
+        for (j = 0; j < object->properties_count; j++) {
+            JSProperty* property = object->properties + j;
+            fprintf(out, "    { ");
+            snapshot_write_cstring(out, property->key.cstring, property->key.length);
+            fprintf(out, ", %u, %uu, ", property->key.length, property->key_hash);
+            snapshot_write_value(out, &index, property->value);
+            fprintf(out, " },\n");
+        }
+    }
+    fprintf(out, "    { NULL, 0, 0, { TypeUndefined, 0, NULL, 0 } }\n};\n");
+
+    fprintf(out, "static JSSnapshot js_snapshot = { %u, %u, %u, js_snapshot_objects, js_snapshot_properties, %u };\n",
+        snapshot_count_functions(snapshot_natives), snapshot_count_functions(functions), env->objects_count,
+        snapshot_object_reference(&index, env->global.as.object));
+    free(index.objects);
+    free(index.positions);
+}
+
+void js_snapshot_write_if_requested(JSEnv* env, JSValue (**functions)()) {
+    char* file_name = getenv("JS_SNAPSHOT_OUT");
+    if (file_name == NULL) {
+        return;
+    }
+    FILE* out = fopen(file_name, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Cannot open %s\n", file_name);
+        exit(1);
+    }
+    snapshot_write(env, out, functions);
+    fclose(out);
+    exit(0);
+}
+
+static JSValue snapshot_value(JSObject** objects, JSSnapshotValue* value) {
+    JSValue result;
+    result.type = value->type;
+    switch (value->type) {
+        case TypeNumber:
+            result.as.number = value->number;
+            break;
+        case TypeBoolean:
+            result.as.boolean = value->number;
+            break;
+        case TypeString:
+            result.as.string.cstring = value->cstring;
+            result.as.string.length = value->length;
+            break;
+        case TypeObject:
+            result.as.object = value->number ? objects[value->number - 1] : NULL;
+            break;
+        default:
+            break;
+    }
+    return result;
+}
+
+// Creates objects described by the image. Strings are not copied, they stay
+// in the image.
+void js_snapshot_load(JSEnv* env, JSSnapshot* snapshot, JSValue (**functions)()) {
+    unsigned int i, j, natives_count = snapshot_count_functions(snapshot_natives);
+    if (snapshot->natives_count != natives_count || snapshot->functions_count != snapshot_count_functions(functions)) {
+        fprintf(stderr, "Heap snapshot doesn't match the program\n");
+        exit(1);
+    }
+
+    JSObject** objects = malloc(sizeof(JSObject*) * snapshot->objects_count);
+    for (i = 0; i < snapshot->objects_count; i++) {
+        if (snapshot->objects[i].class == ClassFunction) {
+            objects[i] = object_init((JSObject*) function_object_alloc(), NULL);
+        } else {
+            objects[i] = object_init(object_alloc(), NULL);
+        }
+        objects[i]->class = snapshot->objects[i].class;
+        js_gc_save_object(env, objects[i]);
+    }
+    for (i = 0; i < snapshot->objects_count; i++) {
+        JSSnapshotObject* image = snapshot->objects + i;
+        JSObject* object = objects[i];
+        if (image->prototype) {
+            object->prototype = objects[image->prototype - 1];
+        }
+        object->primitive = snapshot_value(objects, &image->primitive);
+        object->lazy_prototype = image->lazy_prototype;
+        if (image->class == ClassFunction) {
+            JSFunctionObject* function_object = (JSFunctionObject*) object;
+            if (image->function > natives_count) {
+                function_object->function = functions[image->function - natives_count - 1];
+            } else {
+                function_object->function = snapshot_natives[image->function - 1];
+            }
+            function_object->binding = image->binding ? objects[image->binding - 1] : NULL;
+            function_object->bytecode = NULL;
+        }
+        if (image->properties_count > 0) {
+            // sizes are powers of two, like in object_add_property
+            object->properties_size = 1;
+            while (object->properties_size < image->properties_count) {
+                object->properties_size *= 2;
+            }
+            object->properties = malloc(sizeof(JSProperty) * object->properties_size);
+            object->properties_count = image->properties_count;
+            for (j = 0; j < image->properties_count; j++) {
+                JSSnapshotProperty* property = snapshot->properties + image->properties + j;
+                object->properties[j].key.cstring = property->key;
+                object->properties[j].key.length = property->key_length;
+                object->properties[j].key_hash = property->key_hash;
+                object->properties[j].value = snapshot_value(objects, &property->value);
+            }
+            if (object->properties_size > JS_DICTIONARY_THRESHOLD) {
+                object_index_rebuild(object);
+            }
+        }
+    }
+    env->global = js_object_value_from_object(objects[snapshot->global - 1]);
+    free(objects);
+}
@@ -0,0 +1,594 @@
+// Types and public API of the runtime. Generated programs include js.c,
+// which pulls in this header; programs split into several translation units
+// include only this header and link against separately compiled js.c.
+
+#ifndef JS_H
+#define JS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+enum JSType {
+    TypeUndefined,
+    TypeNumber,
+    TypeString,
+    TypeBoolean,
+    TypeObject
+};
+
+typedef struct {
+    char* cstring;
+    unsigned int length;
+} JSString;
+
+typedef struct TJSValue {
+    enum JSType type;
+    union {
+        int number;
+        JSString string;
+        char boolean;
+        struct TJSObject* object;
+    } as;
+} JSValue;
+
+typedef unsigned int JSStringHash;
+
+typedef struct {
+    JSString key;
+    JSStringHash key_hash;
+    JSValue value;
+} JSProperty;
+
+enum JSObjectClass {
+    ClassObject,
+    ClassFunction,
+    ClassArray,
+    // created by new Worker, see js_worker_constructor
+    ClassWorker,
+    // classes below are JSBufferObjects
+    ClassArrayBuffer,
+    ClassInt32Array,
+    ClassUint8Array
+};
+
+// Keys enumerated by for-in: own keys of an object followed by inherited keys
+// which are not shadowed. Snapshots are reference counted; they are held by
+// the object they describe, by loops iterating over them and by snapshots of
+// objects inheriting from it (parent).
+typedef struct TJSForInKeys {
+    unsigned int refs;
+    unsigned int properties_count;
+    struct TJSForInKeys* parent;
+    unsigned int count;
+    JSString* keys;
+} JSForInKeys;
+
+// Properties are kept in insertion order. Objects with more than
+// JS_DICTIONARY_THRESHOLD properties switch to dictionary mode: they get an
+// open-addressing hash table (index) with 2 * properties_size slots, holding
+// positions of properties plus one (zero is an empty slot).
+typedef struct TJSObject {
+    enum JSObjectClass class;
+    JSProperty* properties;
+    unsigned int properties_count;
+    unsigned int properties_size;
+    unsigned int* index;
+    JSForInKeys* for_in_keys;
+    struct TJSObject* prototype;
+    struct TJSValue primitive;
+    char gc_mark;
+    // set on functions whose prototype property isn't created yet
+    char lazy_prototype;
+#ifdef JS_ALLOC_PROFILE
+    // allocation site and whether the object has been through a collection
+    unsigned int alloc_site;
+    char alloc_collected;
+#endif
+} JSObject;
+
+// Function compiled by bytecode_backend.js, see the bytecode interpreter in
+// js.c.
+typedef struct {
+    unsigned int args_count;
+    JSString* args;
+    unsigned int locals_count;
+    JSString* locals;
+    char uses_arguments;
+    unsigned int for_in_slots;
+    int* code;
+} JSBytecodeFunction;
+
+typedef struct {
+    JSObject as_object;
+    JSValue (*function)();
+    JSObject* binding;
+    // set instead of function for functions run by the interpreter
+    JSBytecodeFunction* bytecode;
+} JSFunctionObject;
+
+// ArrayBuffer owns length bytes of data. Typed arrays have length elements
+// starting at data, which points into their buffer.
+typedef struct {
+    JSObject as_object;
+    unsigned char* data;
+    unsigned int length;
+    JSObject* buffer;
+} JSBufferObject;
+
+// Call stack and GC mark stack start with *_SIZE/*_DEPTH entries and grow up
+// to *_LIMIT entries.
+#define JS_CALL_STACK_SIZE 8192
+#ifndef JS_CALL_STACK_LIMIT
+#define JS_CALL_STACK_LIMIT (1 << 20)
+#endif
+#define JS_EXCEPTION_STACK_SIZE 1024
+#ifndef JS_GC_THRESHOLD
+#define JS_GC_THRESHOLD 65536
+#endif
+// bytes of ArrayBuffers, which also start a collection
+#ifndef JS_GC_BUFFER_THRESHOLD
+#define JS_GC_BUFFER_THRESHOLD (1 << 24)
+#endif
+#ifndef JS_DICTIONARY_THRESHOLD
+#define JS_DICTIONARY_THRESHOLD 8
+#endif
+#define JS_GC_STACK_DEPTH 4096
+#ifndef JS_GC_STACK_LIMIT
+#define JS_GC_STACK_LIMIT (1 << 20)
+#endif
+
+#define JS_CALL_STACK_ITEM(i) (env->call_stack[env->call_stack_count - stack_count + (i)])
+#define JS_CALL_STACK_PUSH(x) js_call_stack_push(env, (x))
+#define JS_CALL_STACK_POP     (env->call_stack_count -= stack_count)
+
+#define JS_IS_FUNCTION(x) (x.type == TypeObject && x.as.object && x.as.object->class == ClassFunction)
+
+typedef struct {
+    jmp_buf jmp;
+    JSValue value;
+    unsigned int call_stack_count;
+    unsigned int for_in_count;
+#ifdef JS_PROFILE
+    unsigned int profile_depth;
+#endif
+} JSException;
+
+// Hash table mapping string labels of a switch statement to their positions.
+// Generated code keeps one per switch, built on first use.
+typedef struct {
+    unsigned int size;
+    int* slots;
+    JSStringHash* hashes;
+} JSSwitchTable;
+
+// Keys of an object literal, in the order of their values. Generated code
+// keeps one per literal; the template of properties (keys with their hashes,
+// without repeated keys) is built on first use.
+typedef struct {
+    unsigned int count;
+    char** keys;
+    unsigned int properties_count;
+    unsigned int* positions;
+    JSProperty* properties;
+} JSObjectLayout;
+
+// Program loaded from the text written by bytecode_backend.js. Code refers
+// to strings, global names, layouts and functions by their indices.
+typedef struct {
+    char* text;
+    JSString* strings;
+    unsigned int strings_count;
+    char** global_names;
+    JSObjectLayout* layouts;
+    unsigned int layouts_count;
+    JSBytecodeFunction* functions;
+    unsigned int functions_count;
+    unsigned int prelude;
+    unsigned int program;
+} JSBytecodeProgram;
+
+// Compiled JS function, as described in a table generated by the compiler.
+typedef struct {
+    char* c_name;
+    char* name;
+    char* file;
+    int line;
+} JSFunctionInfo;
+
+// Place in the program where objects or strings are allocated.
+typedef struct {
+    char* kind;
+    char* function;
+    char* file;
+    int line;
+} JSAllocSiteInfo;
+
+// Operator (kind is the operator) or condition (kind "branch") for which
+// the feedback build records types of operands or outcomes.
+typedef struct {
+    char* kind;
+    char* file;
+    int line;
+} JSFeedbackSiteInfo;
+
+// Garbage collector statistics: totals and the last cycle. Sizes count
+// object structures and their property arrays, but not strings.
+typedef struct {
+    unsigned int cycles;
+    unsigned long long total_pause_ns;
+    unsigned long long max_pause_ns;
+    unsigned long long last_pause_ns;
+    unsigned int objects_before;
+    unsigned int objects_after;
+    size_t bytes_before;
+    size_t bytes_after;
+    size_t property_bytes_after;
+    size_t max_bytes_before;
+    unsigned int mark_stack_depth;
+    unsigned int max_mark_stack_depth;
+    // Times the mark stack hit JS_GC_STACK_LIMIT and the heap was rescanned.
+    unsigned int mark_stack_overflows;
+    // Why js_gc_should_run() started the last cycle, and its limit.
+    const char* trigger;
+    unsigned int trigger_limit;
+} JSGCStats;
+
+// Heap image written by js_snapshot_write and loaded by js_snapshot_load.
+// Objects refer to each other by position in the image plus one (zero is
+// NULL). Functions are numbered with natives first, followed by functions of
+// the program.
+typedef struct {
+    enum JSType type;
+    int number;
+    char* cstring;
+    unsigned int length;
+} JSSnapshotValue;
+
+typedef struct {
+    enum JSObjectClass class;
+    unsigned int prototype;
+    unsigned int function;
+    unsigned int binding;
+    JSSnapshotValue primitive;
+    unsigned int properties;
+    unsigned int properties_count;
+    char lazy_prototype;
+} JSSnapshotObject;
+
+typedef struct {
+    char* key;
+    unsigned int key_length;
+    JSStringHash key_hash;
+    JSSnapshotValue value;
+} JSSnapshotProperty;
+
+typedef struct {
+    unsigned int natives_count;
+    unsigned int functions_count;
+    unsigned int objects_count;
+    JSSnapshotObject* objects;
+    JSSnapshotProperty* properties;
+    unsigned int global;
+} JSSnapshot;
+
+// Message posted by a worker, waiting to be received by its parent.
+typedef struct TJSMessage {
+    JSString data;
+    struct TJSMessage* next;
+} JSMessage;
+
+// Worker runs the program in its own environment on its own thread, starting
+// with a module. The parent and the worker share only this structure; module
+// name, data and messages are copied.
+typedef struct TJSWorker {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    JSString module;
+    JSString data;
+    JSMessage* first_message;
+    JSMessage* last_message;
+    char done;
+    char joined;
+} JSWorker;
+
+// Built-in objects which the runtime refers to, see intrinsic() in js.c.
+typedef enum {
+    IntrinsicObjectPrototype,
+    IntrinsicFunctionPrototype,
+    IntrinsicArray,
+    IntrinsicNumber,
+    IntrinsicString,
+    IntrinsicTypeError,
+    IntrinsicReferenceError,
+    IntrinsicSyntaxError,
+    IntrinsicArrayBufferPrototype,
+    IntrinsicInt32ArrayPrototype,
+    IntrinsicUint8ArrayPrototype,
+    IntrinsicsCount
+} JSIntrinsic;
+
+// Environments don't share any mutable state, so several of them may run on
+// separate threads.
+typedef struct {
+    JSValue global;
+    JSValue* call_stack;
+    unsigned int call_stack_count;
+    unsigned int call_stack_size;
+    JSException exceptions[JS_EXCEPTION_STACK_SIZE];
+    unsigned int exceptions_count;
+    // keys of for-in loops which are running, released by js_throw when an
+    // exception leaves them
+    JSForInKeys** for_in;
+    unsigned int for_in_count;
+    unsigned int for_in_size;
+    JSObject** objects;
+    unsigned int objects_count;
+    unsigned int objects_size;
+    unsigned int gc_last_objects_count;
+    size_t buffer_bytes;
+    size_t gc_last_buffer_bytes;
+    JSObject** gc_mark_stack;
+    unsigned int gc_mark_stack_count;
+    unsigned int gc_mark_stack_size;
+    char gc_mark_overflow;
+    JSGCStats gc_stats;
+    struct JSProfile* profile;
+    struct JSAllocProfile* alloc_profile;
+    unsigned int alloc_site;
+    struct JSFeedback* feedback;
+    // Global variables referenced by the program, numbered by the compiler.
+    // A cell holds position of the property in the global object plus one,
+    // or zero if it wasn't found yet. Properties are never removed, so once
+    // found, the position stays valid.
+    char** global_names;
+    unsigned int* global_cells;
+    JSObject* intrinsics[IntrinsicsCount];
+    // call left pending by a function which returned instead of making it,
+    // see js_call_function
+    char tail_call;
+    JSValue tail_callee;
+    JSValue tail_this;
+    int tail_count;
+    // worker running this environment (NULL for the main one) and workers
+    // started by it
+    JSWorker* worker;
+    JSWorker** workers;
+    unsigned int workers_count;
+    unsigned int workers_size;
+    // program run by the interpreter, NULL in compiled programs
+    JSBytecodeProgram* bytecode;
+} JSEnv;
+
+// Generated functions report entering and leaving to the profiler when the
+// program is compiled with -DJS_PROFILE.
+#ifdef JS_PROFILE
+#define JS_PROFILE_ENTER(id) js_profile_enter(env, (id))
+#define JS_PROFILE_EXIT()    js_profile_exit(env)
+#else
+#define JS_PROFILE_ENTER(id)
+#define JS_PROFILE_EXIT()
+#endif
+
+// Allocations made by generated code are attributed to sites from the table
+// generated by the compiler when the program is compiled with
+// -DJS_ALLOC_PROFILE. Allocations made by the runtime on its own belong to
+// site 0.
+#ifdef JS_ALLOC_PROFILE
+#define JS_ALLOC_SITE(site)                   (env->alloc_site = (site))
+#define JS_NEW_OBJECT(site)                   js_construct_object_value_at(env, (site))
+#define JS_NEW_OBJECT_LITERAL(site, layout, stack_count) \
+    js_new_object_literal_at(env, (site), (layout), (stack_count))
+#define JS_NEW_FUNCTION(site, function, binding) \
+    js_construct_function_object_value_at(env, (site), (function), (binding))
+#define JS_NEW(site, constructor, args_count) js_invoke_constructor_at(env, (site), (constructor), (args_count))
+#define JS_ADD(site, v1, v2)                  js_add_at(env, (site), (v1), (v2))
+#else
+#define JS_ALLOC_SITE(site)
+#define JS_NEW_OBJECT(site)                   js_construct_object_value(env)
+#define JS_NEW_OBJECT_LITERAL(site, layout, stack_count) \
+    js_new_object_literal(env, (layout), (stack_count))
+#define JS_NEW_FUNCTION(site, function, binding) \
+    js_construct_function_object_value(env, (function), (binding))
+#define JS_NEW(site, constructor, args_count) js_invoke_constructor(env, (constructor), (args_count))
+#define JS_ADD(site, v1, v2)                  js_add(env, (v1), (v2))
+#endif
+
+// Programs compiled with -DJS_FEEDBACK record types of operands (side 0 is
+// the left one) and outcomes of conditions at sites numbered by the compiler,
+// and write them to a profile which the compiler can use to specialize code.
+#ifdef JS_FEEDBACK
+#define JS_OPERAND(site, side, v)  js_feedback_operand(env, (site), (side), (v))
+#define JS_BRANCH(site, condition) js_feedback_branch(env, (site), (condition))
+#else
+#define JS_OPERAND(site, side, v)  (v)
+#define JS_BRANCH(site, condition) (condition)
+#endif
+
+#define JS_LIKELY(condition)   __builtin_expect(!!(condition), 1)
+#define JS_UNLIKELY(condition) __builtin_expect(!!(condition), 0)
+
+// Generated code makes a pending tail call of the function itself by jumping
+// back to its beginning with the callee's binding, this and arguments.
+#define JS_TAIL_CALL_IS_SELF(f) \
+    (JS_IS_FUNCTION(env->tail_callee) && ((JSFunctionObject*) env->tail_callee.as.object)->function == (f))
+#define JS_TAIL_CALL_RESTART() \
+    (parent_binding = ((JSFunctionObject*) env->tail_callee.as.object)->binding, \
+        this = env->tail_this, stack_count = env->tail_count, env->tail_call = 0)
+
+#define JS_GLOBAL_CELL(n) \
+    (env->global_cells[n] ? \
+        env->global.as.object->properties[env->global_cells[n] - 1].value : \
+        js_resolve_global_cell(env, (n)))
+
+// --- values -----------------------------------------------------------------
+
+JSValue js_new_number(int n);
+JSValue js_new_boolean(char i);
+JSValue js_new_undefined();
+JSValue js_new_null();
+JSValue js_string_value_from_string(JSString string);
+JSValue js_string_value_from_cstring(char* cstring);
+JSValue js_object_value_from_object(JSObject* object);
+JSObject* js_construct_object(JSEnv* env);
+JSValue js_construct_object_value(JSEnv* env);
+JSFunctionObject* js_construct_function_object(JSEnv* env, JSValue (*function_ptr)(), JSObject* binding);
+JSValue js_construct_function_object_value(JSEnv* env, JSValue (*function_ptr)(), JSObject* binding);
+
+// --- conversions and operators ----------------------------------------------
+
+JSValue js_to_string(JSEnv* env, JSValue v);
+JSValue js_to_number(JSEnv* env, JSValue v);
+JSValue js_to_boolean(JSValue v);
+JSValue js_to_object(JSEnv* env, JSValue v);
+int js_is_truthy(JSValue v);
+
+JSValue js_typeof(JSValue v);
+JSValue js_instanceof(JSEnv* env, JSValue left, JSValue right);
+JSValue js_add(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_sub(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_mult(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_strict_eq(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_strict_neq(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_eq(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_neq(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_lt(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_gt(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_binary_and(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_binary_xor(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_binary_or(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_logical_and(JSEnv* env, JSValue v1, JSValue v2);
+JSValue js_logical_or(JSEnv* env, JSValue v1, JSValue v2);
+
+// --- function calls ---------------------------------------------------------
+
+JSValue js_call_function(JSEnv* env, JSValue v, JSValue this, int stack_count);
+JSValue js_call_method(JSEnv* env, JSValue object, JSValue key, int stack_count);
+void js_tail_call(JSEnv* env, JSValue v, JSValue this, int stack_count);
+void js_tail_call_method(JSEnv* env, JSValue object, JSValue key, int stack_count);
+JSValue js_invoke_constructor(JSEnv* env, JSValue function, int stack_count);
+
+void js_call_stack_setup(JSEnv* env);
+void js_call_stack_push(JSEnv* env, JSValue value);
+void js_call_stack_pop(JSEnv* env);
+JSValue js_call_stack_pop_and_return(JSEnv* env, JSValue value);
+void js_check_call_stack_overflow(JSEnv* env, int n);
+
+// --- variables and properties -----------------------------------------------
+
+JSValue js_assign_variable(JSEnv* env, JSObject* binding, JSString name, JSValue value);
+JSValue js_get_variable_rvalue(JSEnv* env, JSObject* binding, JSString name);
+void js_global_cells_setup(JSEnv* env, char** names);
+JSValue js_resolve_global_cell(JSEnv* env, unsigned int n);
+JSValue js_set_global_cell(JSEnv* env, unsigned int n, JSValue value);
+JSValue* js_variable_slot(JSObject* binding, JSString name);
+
+JSValue js_get_property(JSEnv* env, JSValue value, JSValue key);
+JSValue js_set_property(JSEnv* env, JSValue object, JSValue key, JSValue value);
+JSValue js_add_property(JSEnv* env, JSValue object, JSValue key, JSValue value);
+JSValue js_new_object_literal(JSEnv* env, JSObjectLayout* layout, int stack_count);
+JSValue js_get_global(JSEnv* env, JSString key);
+
+// --- for-in enumeration -----------------------------------------------------
+
+JSForInKeys* js_for_in_begin(JSEnv* env, JSValue value);
+void js_for_in_end(JSEnv* env, JSForInKeys* keys);
+
+// --- exceptions -------------------------------------------------------------
+
+JSException* js_push_new_exception(JSEnv *env);
+JSException* js_pop_exception(JSEnv *env);
+JSException* js_last_exception(JSEnv *env);
+void js_throw(JSEnv* env, JSValue exception);
+
+// --- garbage collection -----------------------------------------------------
+
+void js_gc_setup(JSEnv* env);
+void js_gc_save_object(JSEnv* env, JSObject* object);
+int js_gc_should_run(JSEnv* env);
+void js_gc_run(JSEnv* env, ...);
+void js_gc_print_stats(JSEnv* env, FILE* out);
+
+// --- profiler ---------------------------------------------------------------
+
+void js_profile_setup(JSEnv* env, JSFunctionInfo* info, unsigned int info_count);
+void js_profile_enter(JSEnv* env, unsigned int function);
+void js_profile_exit(JSEnv* env);
+
+// --- allocation profiler ----------------------------------------------------
+
+void js_alloc_profile_setup(JSEnv* env, JSAllocSiteInfo* sites, unsigned int sites_count);
+JSValue js_construct_object_value_at(JSEnv* env, unsigned int site);
+JSValue js_new_object_literal_at(JSEnv* env, unsigned int site, JSObjectLayout* layout, int stack_count);
+JSValue js_construct_function_object_value_at(JSEnv* env, unsigned int site, JSValue (*function_ptr)(), JSObject* binding);
+JSValue js_invoke_constructor_at(JSEnv* env, unsigned int site, JSValue constructor, int stack_count);
+JSValue js_add_at(JSEnv* env, unsigned int site, JSValue v1, JSValue v2);
+
+// --- type feedback ----------------------------------------------------------
+
+void js_feedback_setup(JSEnv* env, JSFeedbackSiteInfo* sites, unsigned int sites_count);
+JSValue js_feedback_operand(JSEnv* env, unsigned int site, int side, JSValue v);
+int js_feedback_branch(JSEnv* env, unsigned int site, int condition);
+
+// Operators specialized by the compiler for sites whose operands were always
+// numbers. Other operands take the generic path.
+#define JS_NUMBERS_OPERATOR(name, result_type, field, op, generic) \
+    static inline JSValue name(JSEnv* env, unsigned int site, JSValue v1, JSValue v2) { \
+        if (JS_LIKELY(v1.type == TypeNumber && v2.type == TypeNumber)) { \
+            JSValue result; \
+            result.type = result_type; \
+            result.as.field = v1.as.number op v2.as.number; \
+            return result; \
+        } \
+        return generic; \
+    }
+
+JS_NUMBERS_OPERATOR(js_add_numbers, TypeNumber, number, +, JS_ADD(site, v1, v2))
+JS_NUMBERS_OPERATOR(js_sub_numbers, TypeNumber, number, -, js_sub(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_mult_numbers, TypeNumber, number, *, js_mult(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_lt_numbers, TypeBoolean, boolean, <, js_lt(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_gt_numbers, TypeBoolean, boolean, >, js_gt(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_eq_numbers, TypeBoolean, boolean, ==, js_eq(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_neq_numbers, TypeBoolean, boolean, !=, js_neq(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_strict_eq_numbers, TypeBoolean, boolean, ==, js_strict_eq(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_strict_neq_numbers, TypeBoolean, boolean, !=, js_strict_neq(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_binary_and_numbers, TypeNumber, number, &, js_binary_and(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_binary_xor_numbers, TypeNumber, number, ^, js_binary_xor(env, v1, v2))
+JS_NUMBERS_OPERATOR(js_binary_or_numbers, TypeNumber, number, |, js_binary_or(env, v1, v2))
+
+#undef JS_NUMBERS_OPERATOR
+
+// --- runtime counters -------------------------------------------------------
+
+void js_stats_setup(JSEnv* env);
+
+// --- heap snapshots ---------------------------------------------------------
+
+void js_snapshot_write_if_requested(JSEnv* env, JSValue (**functions)());
+void js_snapshot_load(JSEnv* env, JSSnapshot* snapshot, JSValue (**functions)());
+
+// --- environment ------------------------------------------------------------
+
+void js_create_native_objects(JSEnv* env);
+void js_resolve_intrinsics(JSEnv* env);
+void js_create_argv(JSEnv* env, int argc, char** argv);
+void js_env_destroy(JSEnv* env);
+
+// Defined by the compiled program.
+JSEnv* js_program_setup(int argc, char** argv);
+void js_program_prelude(JSEnv* env);
+void js_program_run(JSEnv* env);
+
+// --- low-level helpers used directly by generated code ----------------------
+
+JSString string_from_cstring(char* cstring);
+JSObject* object_new(JSObject* prototype);
+void object_add_property(JSObject* object, JSString key, JSValue value);
+int js_switch_string(JSSwitchTable* table, char** cases, unsigned int count, JSValue value);
+
+#endif
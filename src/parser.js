@@ -482,13 +482,27 @@ var thisVariable = decorate(keyword("this"), AST.ThisVariable);
 
 var variable = decorate(identifier, AST.Variable);
 
+// Source positions are recorded only when parse() was asked to do so. Then
+// sourceLength is the length of the whole input and the position of
+// a node is the number of characters before remaining input.
+var sourceLength = null;
+
+var withPosition = function (node, input) {
+  if (sourceLength !== null) {
+    node.setPosition(sourceLength - input.length);
+  }
+  return node;
+};
+
 var functionLiteral = function (input) {
   var args = parens(sepBy(symbol(","), identifier));
   var body = braces(many(statement));
 
   var p = sequence(
     [keyword("function"), args, body],
-    function (k_, args, statements) { return AST.FunctionLiteral(args, statements); }
+    function (k_, args, statements) {
+      return withPosition(AST.FunctionLiteral(args, statements), input);
+    }
   );
 
   return p(input);
@@ -643,7 +657,7 @@ var functionStatement = function (input) {
   var p = sequence(
     [keyword("function"), identifier, args, body],
     function (k_, name, args, statements) {
-      return AST.FunctionStatement(name, args, statements);
+      return withPosition(AST.FunctionStatement(name, args, statements), input);
     }
   );
 
@@ -838,7 +852,7 @@ var emptyStatement = ret(null);
 
 var semicolon = lexeme(character(";"));
 
-var statement = choice([
+var anyStatement = choice([
     skipTrailing(semicolon, varStatement),
     skipTrailing(semicolon, returnStatement),
     skipTrailing(semicolon, breakStatement),
@@ -861,6 +875,17 @@ var statement = choice([
     skipTrailing(semicolon, emptyStatement)
 ]);
 
+var statement = function (input) {
+  var p = decorate(anyStatement, function (node) {
+    if (node !== null) {
+      withPosition(node, input);
+    }
+    return node;
+  });
+
+  return p(input);
+};
+
 // A program consists of many statements.
 var program = many1(statement);
 
@@ -876,9 +901,16 @@ program = notFollowedBy(anyChar, program);
 // with any remaining input) and return first AST from the list.
 // This is means that if there is more than one successful parse, all but first
 // one are discarded.
-exports.parse = function (input, parser) {
+// With options.positions set, function nodes have their positions in input
+// recorded (see AST's setPosition).
+exports.parse = function (input, parser, options) {
   parser = parser || program;
+  options = options || {};
+  if (options.positions) {
+    sourceLength = input.length;
+  }
   var results = parser(input);
+  sourceLength = null;
   var completeResults = results.filter(function (result) {
     var ast = result[0];
     var rest = result[1];
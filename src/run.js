@@ -1,7 +1,63 @@
 var compiler = require("compiler");
 
+var args;
 if (typeof global.process !== "undefined") { // run only in Node
-  console.log(compiler.compileFile(process.argv[2], process.argv[3]));
+  args = process.argv.slice(2);
 } else {
-  console.log(compiler.compileFile(argv[1], argv[2]));
+  args = argv.slice(1);
+}
+
+// Usage: run.js input.js [dependencies] [--output-dir=DIR] [--functions-per-unit=N] [--feedback=FILE]
+//        run.js input.js [dependencies] --bytecode
+//        run.js input.js --run [dependencies [arguments...]]
+// --bytecode prints bytecode instead of C, --run compiles the program to
+// bytecode and runs it right away (only in the compiled compiler).
+// --feedback specializes C code for the profile written by a feedback build.
+// --shake leaves out unused definitions of runtime.js and modules,
+// --shake-report lists the removed ones on stderr.
+// Options start with "--", everything else is a positional argument.
+var options = {};
+var positional = args.filter(function (arg) {
+  var parts;
+  if (arg.substring(0, 2) === "--") {
+    parts = arg.substring(2, arg.length).split("=");
+    if (parts.length > 1) {
+      options[parts[0]] = parts.slice(1).join("=");
+    } else {
+      options[parts[0]] = true;
+    }
+    return false;
+  } else {
+    return true;
+  }
+});
+
+// Options passed to the compiler, which also reports removed definitions.
+var compileOptions = { feedback: options.feedback, shake: options.shake === true };
+if (options.bytecode) {
+  compileOptions.bytecode = true;
+}
+if (options.run) {
+  compileOptions.bytecode = true;
+}
+
+if (options["output-dir"]) {
+  if (options["functions-per-unit"]) {
+    compileOptions.functionsPerUnit = parseInt(options["functions-per-unit"]);
+  }
+  compiler.compileFileToDirectory(positional[0], positional[1], options["output-dir"], compileOptions);
+} else if (options.run) {
+  if (typeof global.runBytecode === "undefined") {
+    throw "--run is supported only by the compiled compiler";
+  }
+  global.runBytecode(compiler.compileFile(positional[0], positional[1], compileOptions),
+    [positional[0]].concat(positional.slice(2)));
+} else {
+  console.log(compiler.compileFile(positional[0], positional[1], compileOptions));
+}
+
+if (options["shake-report"]) {
+  (compileOptions.removed || []).forEach(function (name) {
+    console.error("removed " + name);
+  });
 }
@@ -150,40 +150,6 @@ Object.keys = function (obj) {
   return result;
 };
 
-String.prototype.replace = function (pattern, replacement) {
-  return this.split(pattern).join(replacement);
-};
-String.prototype.split = function (separator, limit) {
-  // FIXME: limit is not supported
-
-  var results = [];
-  var separatorLength = separator.length;
-  var i = 0, j = 0, from = 0;
-
-  if (separatorLength == 0) {
-    while (i < this.length) {
-      results.push(this.charAt(i));
-      i++;
-    }
-  } else {
-    while (i < this.length) {
-      j = 0;
-      while (this.charAt(i+j) == separator.charAt(j) && j < separatorLength) {
-        j++;
-      }
-      if (j == separatorLength) {
-        results.push(this.substring(from, i));
-        i += j;
-        from = i;
-      } else {
-        i++;
-      }
-    }
-    results.push(this.substring(from, this.length));
-  }
-  return results;
-};
-
 global.Error = function (message) { this.message = message; };
 Error.prototype.name = "Error";
 Error.prototype.message = "";
@@ -199,6 +165,10 @@ global.TypeError = function (message) { this.message = message; };
 TypeError.prototype = new Error();
 TypeError.prototype.name = "TypeError";
 
+global.SyntaxError = function (message) { this.message = message; };
+SyntaxError.prototype = new Error();
+SyntaxError.prototype.name = "SyntaxError";
+
 global.parseInt = function (string, radix) {
   var parseDigit = function (digit) {
     if (digit == "0") return 0;
@@ -240,7 +210,8 @@ global.require.loaded = {};
 
 global.require.loaded.fs = {
   readFileSync: global.readFileSync,
-  writeFileSync: global.writeFileSync
+  writeFileSync: global.writeFileSync,
+  appendFileSync: global.appendFileSync
 };
 global.require.loaded.child_process = {
   exec: function (command, callback) {
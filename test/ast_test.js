@@ -12,3 +12,14 @@ returnStmt = new AST.ReturnStatement("xyz");
 assert.ok(returnStmt instanceof AST.ReturnStatement);
 assert.deepEqual(returnStmt, { returnStatement: "xyz" });
 assert.equal(returnStmt.expression(), "xyz");
+
+var visited = [];
+AST.walk([AST.ReturnStatement(AST.BinaryOp("+", AST.Variable("x"), AST.NumberLiteral(1))).setPosition(5)],
+  function (node, position) {
+    if (node instanceof AST.Variable) {
+      visited.push(node.identifier() + "@" + position);
+    } else {
+      visited.push(position);
+    }
+  });
+assert.deepEqual(visited, [5, 5, "x@5", 5]);
@@ -0,0 +1,81 @@
+var assert = require("assert");
+var fs = require("fs");
+var childProcess = require("child_process");
+var compiler = require("compiler");
+
+var tests = [];
+
+// Runs each function from tests array serially.
+var runTests = function () {
+  tests.reduceRight(function (tail, fn) {
+    return function () { fn(tail); };
+  }, function () {})();
+};
+
+// Programs are run by a compiled runner, which passes bytecode from the file
+// given as its argument to runBytecode.
+var buildRunner = function (callback) {
+  fs.writeFileSync("runner.c", compiler.compile("runBytecode(readFileSync(argv[1]), argv.slice(1));"));
+  childProcess.exec("gcc -o runner runner.c", function (error, stdout, stderr) {
+    assert.equal(null, error, stderr);
+    callback();
+  });
+};
+
+// Like testProgram in c_backend_test.js, but the program is compiled to
+// bytecode and run by the interpreter.
+var testProgram = function (program, expectedOutput) {
+  return function (callback) {
+    fs.writeFileSync("program.bc",
+      compiler.compile("console.log(function () { " + program + "}());", undefined, { bytecode: true }));
+
+    childProcess.exec("./runner program.bc", function (error, stdout, stderr) {
+      console.log(program);
+      assert.strictEqual(stderr, "");
+      assert.strictEqual(stdout, expectedOutput + "\n");
+      assert.equal(null, error);
+      callback();
+    });
+  };
+};
+
+tests.push(buildRunner);
+
+tests.push(testProgram("return 2 * (2 + 2);", "8"));
+tests.push(testProgram("return 'x\\\\y\\n' + \"z\";", "x\\y\nz"));
+tests.push(testProgram("return [1, 2, 3][2] + { x: 2, y: 3 }.y;", "6"));
+tests.push(testProgram("return typeof {} + !true + -(1 + 2) + +4;", "objectfalse-34"));
+tests.push(testProgram("var x = 5, y; x += 2; y = x++; return x + ' ' + y + ' ' + (void x);", "8 8 [undefined]"));
+tests.push(testProgram("var o = {}; o.b = 1; o['a'] = 2; o.b += 1; return Object.keys(o).join() + o.b;", "b,a2"));
+
+// Test: closures, arguments, this and constructors
+tests.push(testProgram("var f = function (x) { return function (y) { return x + y + arguments.length; }; }; return f(1)(2);", "4"));
+tests.push(testProgram("var P = function (x) { this.x = x; }; P.prototype.get = function () { return this.x; }; var p = new P(3); return p.get() + ' ' + (p instanceof P);", "3 true"));
+tests.push(testProgram("var f = function () { return this === global; }; return f();", "true"));
+
+// Test: control flow
+tests.push(testProgram("var i = 0, s = ''; while (i < 3) { if (i === 1) { s = s + 'one'; } else { s = s + i; } i++; } return s;", "0one2"));
+tests.push(testProgram("var s = 0, i; for (i = 0; i < 5; i++) { s = s + i; } return s;", "10"));
+tests.push(testProgram("var f = function (x) { switch (x) { case 1: return 'a'; case 'b': x = 'c'; break; default: return 'd'; } return x; }; return f(1) + f('b') + f(2);", "acd"));
+tests.push(testProgram("var o = {a: 1, b: 2}, k, r = ''; for (k in o) { if (o.hasOwnProperty(k)) { r = r + k + o[k]; } } return r;", "a1b2"));
+tests.push(testProgram("var f = function (o) { var k; for (k in o) { for (k in o) { return k; } } }; return f({x: 1}) + f({y: 1});", "xy"));
+tests.push(testProgram("var o = {a: 1, b: 2}, r = '', i, k; var f = function (x) { var k; for (k in o) { if (k === x) { throw k; } } }; for (i = 0; i < 3; i++) { switch (i) { case 1: for (k in o) { r = r + k; break; } break; default: r = r + i; } try { f('b'); } catch (e) { r = r + e; } } return r;", "0bab2b"));
+
+// Test: exceptions
+tests.push(testProgram("try { throw new TypeError('t'); } catch (e) { return e instanceof TypeError; }", "true"));
+tests.push(testProgram("var s = ''; var f = function () { try { return 'a'; } finally { s = 'b'; } }; return f() + s;", "ab"));
+tests.push(testProgram("var f = function (k) { if (k > 0) { try { return f(k - 1); } finally { k = 0; } } return arguments.length; }; return f(2);", "1"));
+tests.push(testProgram("var f = function (x) { throw x; }; var i = 0; while (i < 10000) { try { f(i); } catch (e) { i = i + 1; } } return i;", "10000"));
+tests.push(testProgram("return undefinedVariable;", "ReferenceError: undefinedVariable is not defined."));
+
+// Test: calls in tail position run in constant stack
+tests.push(testProgram("var count = function (n, acc) { if (n === 0) { return acc; } return count(n - 1, acc + 1); }; return count(3000000, 0);", "3000000"));
+tests.push(testProgram("var o = { n: 0, step: function (k) { if (k === 0) { return this.n; } this.n += 1; return this.step(k - 1); } }; return o.step(500000);", "500000"));
+
+// Test: garbage collection keeps values on the stack
+tests.push(testProgram("var a = [], i = 0; while (i < 200000) { a.push({ i: i }); i = i + 1; } return a[199999].i + a.length;", "399999"));
+
+// Test: workers are not supported
+tests.push(testProgram("try { new Worker('worker', ''); } catch (e) { return e; }", "Workers are not supported by the bytecode interpreter"));
+
+runTests();
@@ -13,15 +13,16 @@ var runTests = function () {
 };
 
 // For given program, returns a function that will compile & run this program,
-// and then check its output against expected output.
+// and then check its output against expected output. Dependencies are passed
+// and options to the compiler; command builds and runs program.c.
 // The created test function is asynchronous and accepts callback to run when
 // it's done.
-var testProgram = function (program, expectedOutput) {
+var testProgram = function (program, expectedOutput, dependencies, command, options) {
   return function (callback) {
-    var compiled = compiler.compile("console.log(function () { " + program + "}());");
+    var compiled = compiler.compile("console.log(function () { " + program + "}());", dependencies, options);
     fs.writeFileSync("program.c", compiled);
 
-    childProcess.exec("gcc program.c && ./a.out", function (error, stdout, stderr) {
+    childProcess.exec(command || "gcc program.c && ./a.out", function (error, stdout, stderr) {
       console.log(program);
       assert.strictEqual(stderr, "");
       if (typeof expectedOutput !== "undefined") {
@@ -33,6 +34,101 @@ var testProgram = function (program, expectedOutput) {
   };
 };
 
+// Same as testProgram, but the program first writes a heap snapshot and is
+// then rebuilt to start from it.
+var testSnapshotProgram = function (program, expectedOutput) {
+  return testProgram(program, expectedOutput, undefined,
+    "gcc program.c && JS_SNAPSHOT_OUT=snapshot.h ./a.out && " +
+    "gcc -DJS_SNAPSHOT='\"snapshot.h\"' program.c && rm snapshot.h && ./a.out");
+};
+
+// Same as testProgram, but the program is first built with -DJS_FEEDBACK and
+// then rebuilt with code specialized for the profile it wrote.
+var testFeedbackProgram = function (program, expectedOutput) {
+  return function (callback) {
+    fs.writeFileSync("program.c", compiler.compile("console.log(function () { " + program + "}());"));
+    childProcess.exec("gcc -DJS_FEEDBACK program.c && ./a.out", function (error, stdout, stderr) {
+      assert.equal(null, error, stderr);
+      testProgram(program, expectedOutput, undefined, undefined, { feedback: "feedback.txt" })(function () {
+        fs.unlinkSync("feedback.txt");
+        assert.ok(fs.readFileSync("program.c").toString().indexOf("_numbers(env") !== -1);
+        callback();
+      });
+    });
+  };
+};
+
+// Same as testProgram, but the program is built with -DJS_PROFILE, and both
+// its report and folded stacks have to contain given text.
+var testProfileProgram = function (program, expectedOutput, expectedText) {
+  return function (callback) {
+    testProgram(program, expectedOutput, undefined,
+      "gcc -DJS_PROFILE program.c && JS_PROFILE_OUT=profile.txt JS_PROFILE_FOLDED=stacks.txt ./a.out")(function () {
+      ["profile.txt", "stacks.txt"].forEach(function (file) {
+        assert.ok(fs.readFileSync(file).toString().indexOf(expectedText) !== -1, file);
+        fs.unlinkSync(file);
+      });
+      callback();
+    });
+  };
+};
+
+// Same as testProgram, but the program is built with -DJS_ALLOC_PROFILE, and
+// the report has to list given site with the number of objects it allocated.
+var testAllocProfileProgram = function (program, expectedOutput, site, objects) {
+  return function (callback) {
+    testProgram(program, expectedOutput, undefined,
+      "gcc -DJS_ALLOC_PROFILE program.c && JS_ALLOC_PROFILE_OUT=alloc.txt ./a.out")(function () {
+      var lines = fs.readFileSync("alloc.txt").toString().split("\n").filter(function (line) {
+        return line.indexOf(site) !== -1;
+      });
+      fs.unlinkSync("alloc.txt");
+      assert.strictEqual(lines.length, 1, site);
+      assert.strictEqual(parseInt(lines[0], 10), objects);
+      callback();
+    });
+  };
+};
+
+// Same as testProgram, but the program is split into translation units of
+// a few functions each (see compileFileToDirectory) and built by the
+// generated Makefile.
+var testSplitProgram = function (program, expectedOutput) {
+  return function (callback) {
+    if (!fs.existsSync("split")) {
+      fs.mkdirSync("split");
+    }
+    fs.writeFileSync("split/program.js", "console.log(function () { " + program + "}());");
+    compiler.compileFileToDirectory("split/program.js", undefined, "split", { functionsPerUnit: 10 });
+    childProcess.exec("make -s -C split program && ./split/program", function (error, stdout, stderr) {
+      console.log(program);
+      assert.equal(null, error, stderr);
+      assert.strictEqual(stdout, expectedOutput + "\n");
+      assert.ok(fs.existsSync("split/unit_1.c"));
+      childProcess.exec("rm -r split", function () {
+        callback();
+      });
+    });
+  };
+};
+
+// Same as testProgram, but with the shake option, and checks which definitions
+// of runtime.js and modules were left out of the program and which were kept.
+var testShakenProgram = function (program, expectedOutput, dependencies, removed, kept) {
+  return function (callback) {
+    var options = { shake: true };
+    testProgram(program, expectedOutput, dependencies, undefined, options)(function () {
+      removed.forEach(function (name) {
+        assert.ok(options.removed.indexOf(name) !== -1, name + " not removed");
+      });
+      kept.forEach(function (name) {
+        assert.ok(options.removed.indexOf(name) === -1, name + " removed");
+      });
+      callback();
+    });
+  };
+};
+
 tests.push(testProgram("return 123;", "123"));
 tests.push(testProgram("return 100 + 23;", "123"));
 tests.push(testProgram("return 2 * 3;", "6"));
@@ -103,6 +199,13 @@ tests.push(testProgram("function () { x = 2; }(); if (true) {} else { var x; } r
 // Test: Factorial
 tests.push(testProgram("var fac = function (n) { if (n > 0) { return n * fac(n-1); } else { return 1; } }; return fac(5);", "120"));
 
+// Test: calls in tail position don't grow the stack
+tests.push(testProgram("var count = function (n, acc) { if (n === 0) { return acc; } return count(n - 1, acc + 1); }; return count(3000000, 0);", "3000000"));
+tests.push(testProgram("var even = function (n) { if (n === 0) { return true; } return odd(n - 1); }; var odd = function (n) { if (n === 0) { return false; } return even(n - 1); }; return even(1000001);", "false"));
+tests.push(testProgram("var o = { n: 0, step: function (k) { if (k === 0) { return this.n; } this.n += 1; return this.step(k - 1); } }; return o.step(500000);", "500000"));
+tests.push(testProgram("var f = function (k) { var keys = []; var key; for (key in { a: 1 }) { if (k > 0) { return f(k - 1); } keys.push(key); } return keys[0]; }; return f(3);", "a"));
+tests.push(testProgram("var f = function (k) { if (k > 0) { try { return f(k - 1); } finally { k = 0; } } return arguments.length; }; return f(2);", "1"));
+
 // Test: for loop
 tests.push(testProgram("var x = 3; var i; for (i = 0; i < 5; i += 1) { x += 1; } return x;", "8"));
 tests.push(testProgram("var x = 3; for (var i = 0; i < 5; i += 1) { x += 1; } return x;", "8"));
@@ -123,6 +226,10 @@ tests.push(testProgram("var f = function () {}; f.x = 2; return f.x;", "2"));
 // Test: prototypes
 tests.push(testProgram("var X = function () {}; X.prototype.y = 2; var x = new X(); return x.y;", "2"));
 tests.push(testProgram("var X = function () {}; var x = new X(); return x.z;", "[undefined]"));
+tests.push(testProgram("var f = function () {}; var p = f.prototype; return (p === f.prototype) + ' ' + (p.constructor === f) + ' ' + (new f() instanceof f) + ' ' + ({} instanceof f);", "true true true false"));
+tests.push(testProgram("var f = function () {}; f.x = 1; var k = []; var p; for (p in f) { if (f.hasOwnProperty(p)) { k.push(p); } } return k.join(',') + ' ' + function () {}.hasOwnProperty('prototype');", "prototype,x true"));
+tests.push(testProgram("var X = function () {}; X.prototype = { y: 3 }; X.z = 1; var x = new X(); return x.y + ' ' + Object.keys(X).join(',');", "3 prototype,z"));
+tests.push(testProgram("var X = function () {}; var f = function () {}; X.prototype = f; var x = new X(); return x.prototype === f.prototype;", "true"));
 
 // Test: Object prototype method isPrototypeOf
 tests.push(testProgram("var X = function () {}; var x = new X(); return X.prototype.isPrototypeOf(x);", "true"));
@@ -171,6 +278,21 @@ tests.push(testProgram("var s = 'abc'; return s.split('').toString();", "a,b,c")
 tests.push(testProgram("var s = 'aXbXc'; return s.split('X').toString();", "a,b,c"));
 tests.push(testProgram("var s = 'aXbXc'; return s.replace('X', 'Y');", "aYbYc"));
 tests.push(testProgram("var s = 'X'; return s.replace('X', 'Y');", "Y"));
+tests.push(testProgram("return ('abc').indexOf('c') + ' ' + ('abc').indexOf('') + ' ' + ('abc').indexOf('abcd');", "2 0 -1"));
+tests.push(testProgram("var s = '0123456789abcdefghij0123456789abcdefghijXYZ'; return s.indexOf('XYZ') + ' ' + s.indexOf('j', 30);", "40 39"));
+tests.push(testProgram("return ('abcabc').lastIndexOf('bc') + ' ' + ('abcabc').lastIndexOf('bc', 3) + ' ' + ('abc').lastIndexOf('x');", "4 1 -1"));
+tests.push(testProgram("return ('abc').lastIndexOf('a', -1) + ' ' + ('abc').lastIndexOf('b', -1) + ' ' + ('abc').lastIndexOf('', -1) + ' ' + ('a').lastIndexOf('ab', -1);", "0 -1 0 -1"));
+tests.push(testProgram("return ('a,b,,c').split(',').length + ' ' + ('a,b,c').split(',', 2).toString() + ' ' + ('abc').split().length;", "4 a,b 1"));
+
+// Test: files
+tests.push(testProgram("var fs = require('fs'); fs.writeFileSync('test.txt', ('abc').substring(1, 3)); fs.appendFileSync('test.txt', '!'); return fs.readFileSync('test.txt');", "bc!",
+  undefined, "gcc program.c && ./a.out && rm test.txt"));
+// Files are mapped into memory, except ones which fill whole pages.
+tests.push(testProgram("var fs = require('fs'), page = 'abcd', i; for (i = 0; i < 10; i++) { page = page + page; } " +
+  "fs.writeFileSync('test.txt', 'xyz'); fs.writeFileSync('test_page.txt', page); " +
+  "var small = fs.readFileSync('test.txt'), large = fs.readFileSync('test_page.txt'); " +
+  "return small + ' ' + small.length + ' ' + large.length + ' ' + (large === page) + ' ' + (small + large).length;", "xyz 3 4096 true 4099",
+  undefined, "gcc -DJS_MMAP_FILES program.c && ./a.out && rm test.txt test_page.txt"));
 
 // Test: Error objects
 tests.push(testProgram("var e = new Error('msg'); return e.name;", "Error"));
@@ -272,4 +394,108 @@ tests.push(testProgram("var x = { a: 1, b: 2 }; return Object.keys(x).toString()
 tests.push(testProgram("return parseInt('2');", "2"));
 tests.push(testProgram("return parseInt('123');", "123"));
 
+// Test: global variables
+tests.push(testProgram("var f = function () { g = 1; }; f(); g = g + 1; return g + ' ' + global.g;", "2 2"));
+tests.push(testProgram("global.h = 3; var f = function () { return h; }; return f();", "3"));
+tests.push(testProgram("try { return missing; } catch (e) { return e.toString(); }", "ReferenceError: missing is not defined."));
+tests.push(testProgram("var e = 1; try { throw 2; } catch (e) { e = 3; } return e;", "1"));
+
+// Test: runtime keeps using built-ins after their globals are reassigned
+tests.push(testProgram("var O = Object; Object = 1; Function = 2; var o = {}; var f = function () { return 3; }; return o.hasOwnProperty('x') + ' ' + (o.constructor === O) + ' ' + f.call(null);", "false true 3"));
+tests.push(testProgram("var T = TypeError; TypeError = 1; var x = 1; try { x(); } catch (e) { return (e instanceof T) + ' ' + e.message; }", "true number is not a function."));
+
+// Test: objects with many properties (dictionary mode) keep insertion order
+tests.push(testProgram("var m = {}; var i = 0; while (i < 1000) { m['k' + i] = i; i = i + 1; } m.k500 = 'x'; var k = Object.keys(m); return k.length + ' ' + k[0] + ' ' + k[999] + ' ' + m.k999 + ' ' + m.k500 + ' ' + m.k1000;", "1000 k0 k999 999 x [undefined]"));
+
+// Test: object literals evaluate values in order, repeated keys keep first position
+tests.push(testProgram("var s = ''; var f = function (x) { s = s + x; return x; }; var o = { b: f(1), a: { c: f(2) }, b: f(3) }; return s + ' ' + Object.keys(o).toString() + ' ' + o.b + o.a.c;", "123 b,a 32"));
+tests.push(testProgram("var o = { k0: 0, k1: 1, k2: 2, k3: 3, k4: 4, k5: 5, k6: 6, k7: 7, k8: 8, k9: 9, 'a\\'b': 10 }; o.z = 11; return o.k0 + ' ' + o.k9 + ' ' + o[\"a'b\"] + ' ' + o.z + ' ' + Object.keys(o).length;", "0 9 10 11 12"));
+
+// Test: for-in iterates over a snapshot of keys, shadowed keys appear once
+tests.push(testProgram("var o = {a: 1, b: 2}; var r = ''; var k; for (k in o) { if (o.hasOwnProperty(k)) { r = r + k; o[k + k] = 1; } } return r + ' ' + Object.keys(o).length;", "ab 4"));
+tests.push(testProgram("var P = function () {}; P.prototype.a = 1; var o = new P(); o.a = 2; var n = 0; var k; for (k in o) { if (k === 'a') { n = n + 1; } } return n;", "1"));
+tests.push(testProgram("var f = function (o) { var k; for (k in o) { for (k in o) { try { return k; } finally {} } } }; return f({x: 1}) + f({y: 1});", "xy"));
+tests.push(testProgram("var n = 0; var k; for (k in null) { n = n + 1; } return n;", "0"));
+tests.push(testProgram("var o = {a: 1, b: 2}, r = '', i, k; var f = function (x) { var k; for (k in o) { if (k === x) { throw k; } } }; for (i = 0; i < 3; i++) { switch (i) { case 1: for (k in o) { r = r + k; break; } break; default: r = r + i; } try { f('b'); } catch (e) { r = r + e; } } return r;", "0bab2b"));
+tests.push(testProgram("var a = null; return a.x;", "[undefined]"));
+
+// Test: switch over number and string literals, duplicate labels, no default
+tests.push(testProgram("var f = function (x) { switch (x) { case 1: return 'a'; case 2: return 'b'; case 1: return 'c'; default: return 'd'; } }; return f(1) + f(2) + f(3) + f('1');", "abdd"));
+tests.push(testProgram("var f = function (x) { switch (x) { case '+': return 'a'; case '-': return 'b'; } return 'n'; }; return f('+') + f('-') + f('*') + f(1);", "abnn"));
+tests.push(testProgram("var f = function (x) { var one = 1; switch (x) { case one: return 'a'; case '1': return 'b'; } return 'n'; }; return f(1) + f('1') + f(2);", "abn"));
+
+// Test: call stack grows beyond its initial size, exceptions don't leak it
+tests.push(testProgram("var a = []; var i = 0; while (i < 10000) { a.push(i); i = i + 1; } var f = function () { return arguments.length; }; return f.apply(null, a);", "10000"));
+tests.push(testProgram("var f = function (x) { throw x; }; var i = 0; while (i < 10000) { try { f(i); } catch (e) { i = i + 1; } } return i;", "10000"));
+
+// Test: workers run modules in parallel environments
+tests.push(testProgram("var w = new Worker('worker', 'abcd'); var a = w.receive(); var b = w.receive(); var c = w.receive(); w.join(); return a + ', ' + b + ', ' + c;",
+  "data abcd, sum 10, [undefined]", "worker=test/worker_module.js"));
+tests.push(testProgram("var ws = ['a', 'ab', 'abc'].map(function (s) { return new Worker('worker', s); }); return ws.map(function (w) { w.receive(); var sum = w.receive(); w.join(); return sum; }).join(', ');",
+  "sum 1, sum 3, sum 6", "worker=test/worker_module.js"));
+tests.push(testProgram("var v = new Worker('worker', 'a'), w = { receive: v.receive }, r = ''; try { w.receive(); } catch (e) { r = r + (e instanceof TypeError); } " +
+  "try { Worker.prototype.receive.call(new Number(0)); } catch (e) { r = r + ' ' + (e instanceof TypeError); } v.join(); return r;",
+  "true true", "worker=test/worker_module.js"));
+
+// Test: programs started from a heap snapshot
+tests.push(testSnapshotProgram("var e = new TypeError('t'); return [1, 2].map(function (x) { return x + 1; }).join('-') + ' ' + e + ' ' + ('a,b').split(',').length + ' ' + argv.length;", "2-3 TypeError: t 2 1"));
+tests.push(testSnapshotProgram("var m = {}; var i = 0; while (i < 20) { m['k' + i] = i; i = i + 1; } Array.prototype.last = function () { return this[this.length - 1]; }; return Object.keys(m).last() + ' ' + m.k7;", "k19 7"));
+
+// Test: code specialized for a feedback profile
+tests.push(testFeedbackProgram("var add = function (a, b) { return a + b; }; var n = 0, i; for (i = 0; i < 1000; i++) { n = add(n, i & 3); } return add(n, '!') + add('', i);", "1500!1000"));
+
+// Test: gc.stats
+tests.push(testProgram("var s = gc.stats(); return s.cycles + ' ' + s.trigger + ' ' + (s.threshold > 0);", "0 none true"));
+tests.push(testProgram(
+  "var f = function (i) { return { i: i }; }, a = [], i, s; for (i = 0; i < 5000; i++) { a.push(f(i)); f(i); } s = gc.stats(); " +
+  "return (s.cycles > 0) + ' ' + (s.bytesAfter > 0) + ' ' + (s.bytesBefore > s.bytesAfter) + ' ' + (s.maxBytes < s.bytesBefore) + ' ' + " +
+  "(s.objectsBefore > s.objectsAfter) + ' ' + (s.totalPauseUs < s.maxPauseUs) + ' ' + (s.maxPauseUs < 0) + ' ' + s.threshold;",
+  "true true true false true false false 1024", undefined, "gcc -DJS_GC_THRESHOLD=1024 program.c && ./a.out"));
+
+// Test: runtime counters
+tests.push(testProgram("return typeof stats();", "undefined"));
+tests.push(testProgram(
+  "var P = function () {}; P.prototype.f = function (x) { return x; }; var p = new P(), s = stats(), t, i; " +
+  "for (i = 0; i < 10; i++) { p.f(i + ''); try { throw 1; } catch (e) {} } t = stats(); " +
+  "return [t.methodCalls - s.methodCalls, t.numberToString - s.numberToString, t.throws - s.throws, " +
+  "t.tryBlocks - s.tryBlocks].join() + ' ' + (t.prototypeDepthMax > 0) + ' ' + (t.hashedBytes > 0);",
+  "10,10,10,10 true true", undefined, "gcc -DJS_STATS program.c && ./a.out 2>/dev/null"));
+
+// Test: JSON
+tests.push(testProgram("var o = JSON.parse(' {\"a\": [1, -2, 3.7, true, null, \"x\\\\n\\\\u00e9\"], \"b\": 1, \"b\": {\"c\": \"\"}} '); return o.a.length + ' ' + o.a[2] + ' ' + Object.keys(o).join() + ' ' + JSON.stringify(o);",
+  "6 3 a,b {\"a\":[1,-2,3,true,null,\"x\\n\u00e9\"],\"b\":{\"c\":\"\"}}"));
+tests.push(testProgram("return JSON.stringify({ a: [undefined, new String('s')], f: function () {}, n: null }, null, 1) + typeof JSON.stringify(undefined);",
+  "{\n \"a\": [\n  null,\n  \"s\"\n ],\n \"n\": null\n}undefined"));
+tests.push(testProgram("var f = function (s) { try { JSON.parse(s); } catch (e) { return e.toString(); } }; return f('[1,]') + ' ' + f('{\"a\"');",
+  "SyntaxError: Unexpected token ] in JSON at position 3 SyntaxError: Unexpected end of JSON input"));
+tests.push(testProgram("var a = [1]; a.push(a); try { JSON.stringify(a); } catch (e) { return e.toString(); }", "TypeError: Converting circular structure to JSON"));
+
+// Test: typed arrays
+tests.push(testProgram("var a = new Int32Array(3); a[0] = -7; a['2'] = 5; a[3] = 9; a.x = 1; return a.length + ' ' + a[0] + a[1] + a[2] + ' ' + a[3] + ' ' + a.x + ' ' + a.byteLength;", "3 -705 [undefined] 1 12"));
+tests.push(testProgram("var b = new ArrayBuffer(8); var u = new Uint8Array(b); var i = new Int32Array(b, 4); u[4] = 1; u[5] = 1; u[0] = 300; return b.byteLength + ' ' + i.length + ' ' + i[0] + ' ' + u[0] + ' ' + (i.buffer === b) + ' ' + (new Uint8Array([1, 258]))[1];", "8 1 257 44 true 2"));
+tests.push(testProgram("var u = new Uint8Array(2); u[-1] = 3; u['-1'] = 4; u['-0'] = 5; u['10000000000'] = 6; u['01'] = 7; " +
+  "return [u[-1], u['-1'], u['-0'], u['10000000000'], u['01'], u[0], u[1]].join() + ' ' + u.hasOwnProperty('-1');", ",,,,7,0,0 false"));
+tests.push(testProgram("var fs = require('fs'); fs.writeFileSync('test.bin', 'AB'); var f = fs.readFileSync('test.bin', null); return f.length + ' ' + f[0] + ' ' + f[1] + ' ' + (f instanceof Uint8Array);", "2 65 66 true",
+  undefined, "gcc program.c && ./a.out && rm test.bin"));
+
+// Test: profiler reports functions with their lines
+tests.push(testProfileProgram("var i, s = 0;\nvar square = function (x) {\n  return x * x;\n};\nfor (i = 0; i < 10; i++) { s = s + square(i); } return s;",
+  "285", "square ((input):2)"));
+
+// Test: allocation profiler reports sites with their objects
+tests.push(testAllocProfileProgram("var a = [], i;\nfor (i = 0; i < 300; i++) { a.push({ i: i }); } return a.length;",
+  "300", "object literal in anonymous ((input):2)", 300));
+
+// Test: programs split into several translation units
+tests.push(testSplitProgram("var f = function (x) { return x + 1; }, g = function (x) { return f(x) * 2; }; return [1, 2].map(g).join() + ' ' + JSON.stringify({ a: f(1) });", "4,6 {\"a\":2}"));
+
+// Test: unused definitions of runtime.js and modules are left out
+tests.push(testShakenProgram("var name = 'slice'; return [3, 1, 2].reverse()[name](1).join() + parseInt('4');", "1,34", "worker=test/worker_module.js",
+  ["require.available.worker", "Array.prototype.reduceRight", "require.loaded.child_process"],
+  ["Array.prototype.slice", "global.parseInt", "Array.prototype.reverse"]));
+tests.push(testShakenProgram("var w = new Worker('worker', 'ab'); w.receive(); var sum = w.receive(); w.join(); return sum;", "sum 3", "worker=test/worker_module.js",
+  ["global.parseInt"], ["require.available.worker"]));
+// Methods called through names built at runtime are kept by default.
+tests.push(testProgram("var a = [3, 1, 2]; return a['ma' + 'p'](function (x) { return x * 2; }).join();", "6,2,4"));
+
 runTests();
@@ -265,6 +265,12 @@ testParser("void 0", { unaryOp: ["void", { numberLiteral: 0 } ] }, parser.expr);
 testParser('"\\"xy\\""', { stringLiteral: '"xy"' }, parser.stringLiteral);
 testParser('"aa\\nbb"', { stringLiteral: 'aa\nbb' }, parser.stringLiteral);
 
+// source positions of functions and statements
+var positioned = parser.parse("var f = 1;\nvar g = function () { return function (x) {}; };", undefined, { positions: true });
+assert.equal(positioned.success[1].varStatement[0].varWithValueDeclaration[1].position(), 19);
+assert.equal(positioned.success[1].varStatement[0].varWithValueDeclaration[1].statements()[0].returnStatement.position(), 40);
+assert.equal(positioned.success[1].position(), 11);
+assert.equal(typeof parser.parse("function () {}", parser.expr).success.position(), "undefined");
 
 // tests on real files
 testParserOnFile("src/parser.js");
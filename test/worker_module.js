@@ -0,0 +1,11 @@
+// Module run by workers in c_backend_test.js. Sends back its data and the
+// sum of numbers up to its length.
+var n = workerData.length;
+var sum = 0;
+var i = 0;
+while (i < n) {
+  i = i + 1;
+  sum = sum + i;
+}
+postMessage("data " + workerData);
+postMessage("sum " + sum);